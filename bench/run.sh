@@ -0,0 +1,22 @@
+#!/bin/sh
+# Сравнение вариантов сборки на одной нагрузке: лучшее время из RUNS запусков.
+#
+# Использование: bench/run.sh kubsh-binary...
+
+RUNS=${RUNS:-3}
+ITERATIONS=${ITERATIONS:-200}
+DIR=$(dirname "$0")
+
+printf '%-40s %10s\n' "binary" "best, ms"
+for bin in "$@"; do
+    best=
+    run=0
+    while [ "$run" -lt "$RUNS" ]; do
+        ms=$("$DIR/workload.sh" "$bin" "$ITERATIONS")
+        if [ -z "$best" ] || [ "$ms" -lt "$best" ]; then
+            best=$ms
+        fi
+        run=$((run + 1))
+    done
+    printf '%-40s %10s\n' "$bin" "$best"
+done
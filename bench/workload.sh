@@ -0,0 +1,53 @@
+#!/bin/sh
+# Нагрузка для PGO-тренировки и бенчмарка: разбор строк, перенаправления,
+# запуск внешних команд, история, чтение VFS.
+#
+# Использование: bench/workload.sh ./kubsh [итераций]
+
+set -e
+
+BIN=${1:?usage: $0 path/to/kubsh [iterations]}
+ITERATIONS=${2:-200}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+OUT=$WORK/out
+MOUNT=$WORK/users
+mkdir -p "$OUT" "$MOUNT"
+
+# Отдельный HOME: история и ~/.kubshrc не трогают пользователя.
+# VFS монтируется во временный каталог - mkdir/rmdir (adduser) не вызываются.
+cat > "$WORK/.kubshrc" <<RC
+alias ll=ls -l
+export KUBSH_BENCH=1
+set vfs.mount=$MOUNT
+RC
+
+i=0
+while [ "$i" -lt "$ITERATIONS" ]; do
+    cat <<CMDS
+echo parsing 'quoted' "words" iteration $i > $OUT/echo.txt
+echo append line >> $OUT/echo.txt
+debug 'training run'
+\\e \$PATH
+\\e \$KUBSH_BENCH > $OUT/env.txt
+true
+/bin/true
+ll $OUT > $OUT/ls.txt
+cat $OUT/echo.txt 2>&1 > /dev/null
+ls $MOUNT > /dev/null
+cat $MOUNT/root/shell $MOUNT/root/groups $MOUNT/root/sudo > /dev/null 2>&1
+no_such_command_$i
+for f in $OUT/*.txt; do if [ -s \$f ]; then n=\$f; else n=empty; fi; done > /dev/null
+CMDS
+    i=$((i + 1))
+done > "$WORK/commands"
+echo 'history > '"$OUT"'/history.txt' >> "$WORK/commands"
+
+# WORKLOAD_LOG=file - сохранить вывод шелла для проверки нагрузки
+start=$(date +%s%N)
+HOME=$WORK "$BIN" < "$WORK/commands" > "${WORKLOAD_LOG:-/dev/null}" 2>&1 || true
+end=$(date +%s%N)
+
+echo $(( (end - start) / 1000000 ))
@@ -0,0 +1,391 @@
+#include "config.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <signal.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+// Заголовок скомпилированного кэша. Меняем версию при изменении формата.
+static const char CACHE_MAGIC[8] = {'K', 'U', 'B', 'S', 'H', 'R', 'C', 3};
+
+static mutex config_mutex;
+static shared_ptr<const Config> config = make_shared<Config>();
+static atomic<uint64_t> next_generation{1};
+
+// Self-pipe: обработчик SIGHUP пишет байт, фоновый поток пересобирает конфиг
+static int reload_pipe[2] = {-1, -1};
+
+// ==================== Пути ====================
+
+// HOME читается один раз в config_init, до запуска потока перезагрузки:
+// тот не должен звать getenv, пока основной поток меняет окружение через setenv
+static string home;
+
+static const string& home_dir() {
+    return home;
+}
+
+static string rc_path() {
+    return home_dir() + "/.kubshrc";
+}
+
+static string cache_dir() {
+    return home_dir() + "/.cache/kubsh";
+}
+
+static string cache_path() {
+    return cache_dir() + "/kubshrc.bin";
+}
+
+// ==================== Разбор текстового файла ====================
+
+static string trim(const string& s) {
+    size_t start = s.find_first_not_of(" \t\r");
+    if (start == string::npos) return "";
+    size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(start, end - start + 1);
+}
+
+// Снимает одну пару внешних кавычек
+static string unquote(const string& s) {
+    if (s.size() >= 2 && (s[0] == '"' || s[0] == '\'') && s.back() == s[0]) {
+        return s.substr(1, s.size() - 2);
+    }
+    return s;
+}
+
+static string expand_tilde(const string& s) {
+    if (s == "~" || s.compare(0, 2, "~/") == 0) {
+        return home_dir() + s.substr(1);
+    }
+    return s;
+}
+
+static bool split_assignment(const string& s, string& key, string& value) {
+    size_t eq = s.find('=');
+    if (eq == string::npos || eq == 0) return false;
+    key = trim(s.substr(0, eq));
+    value = unquote(trim(s.substr(eq + 1)));
+    return !key.empty() && key.find_first_of(" \t") == string::npos;
+}
+
+static bool is_true(const string& value) {
+    return value == "yes" || value == "true" || value == "1" || value == "on";
+}
+
+static bool apply_setting(Config& cfg, const string& key, const string& value) {
+    if (key == "vfs.mount") {
+        cfg.vfs_mount = expand_tilde(value);
+    } else if (key == "vfs.enabled") {
+        cfg.vfs_enabled = is_true(value);
+    } else if (key == "vfs.event_loop") {
+        cfg.vfs_event_loop = is_true(value);
+    } else if (key == "vfs.writeback_ms") {
+        cfg.vfs_writeback_ms = atoi(value.c_str());
+        if (cfg.vfs_writeback_ms < 0) cfg.vfs_writeback_ms = 0;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void parse_rc(istream& in, Config& cfg) {
+    string line;
+    int line_no = 0;
+
+    while (getline(in, line)) {
+        line_no++;
+        line = trim(line);
+        if (line.empty() || line[0] == '#') continue;
+
+        string key, value;
+        bool ok = true;
+
+        if (line.compare(0, 6, "alias ") == 0) {
+            ok = split_assignment(line.substr(6), key, value);
+            if (ok) cfg.aliases[key] = value;
+        } else if (line.compare(0, 5, "path ") == 0) {
+            cfg.path_prepend.push_back(expand_tilde(unquote(trim(line.substr(5)))));
+        } else if (line.compare(0, 4, "set ") == 0) {
+            ok = split_assignment(line.substr(4), key, value) && apply_setting(cfg, key, value);
+        } else {
+            if (line.compare(0, 7, "export ") == 0) line = line.substr(7);
+            ok = split_assignment(line, key, value);
+            if (ok) cfg.variables.emplace_back(key, expand_tilde(value));
+        }
+
+        if (!ok) {
+            cerr << "kubshrc:" << line_no << ": cannot parse: " << line << endl;
+        }
+    }
+}
+
+// ==================== Скомпилированный кэш ====================
+
+// Кэш валиден, пока у ~/.kubshrc тот же inode, размер и mtime
+struct RcStamp {
+    int64_t ino = 0;
+    int64_t size = 0;
+    int64_t mtime_sec = 0;
+    int64_t mtime_nsec = 0;
+
+    bool operator==(const RcStamp& o) const {
+        return ino == o.ino && size == o.size &&
+               mtime_sec == o.mtime_sec && mtime_nsec == o.mtime_nsec;
+    }
+};
+
+static void put_raw(string& out, const void* data, size_t len) {
+    out.append(static_cast<const char*>(data), len);
+}
+
+static void put_u32(string& out, uint32_t v) {
+    put_raw(out, &v, sizeof(v));
+}
+
+static void put_str(string& out, const string& s) {
+    put_u32(out, s.size());
+    out += s;
+}
+
+// Читатель с проверкой границ: любой выход за конец делает кэш невалидным
+struct CacheReader {
+    const string& data;
+    size_t pos = 0;
+    bool ok = true;
+
+    void raw(void* dst, size_t len) {
+        if (!ok || pos + len > data.size()) {
+            ok = false;
+            return;
+        }
+        memcpy(dst, data.data() + pos, len);
+        pos += len;
+    }
+
+    uint32_t u32() {
+        uint32_t v = 0;
+        raw(&v, sizeof(v));
+        return v;
+    }
+
+    string str() {
+        uint32_t len = u32();
+        if (!ok || pos + len > data.size()) {
+            ok = false;
+            return "";
+        }
+        string s = data.substr(pos, len);
+        pos += len;
+        return s;
+    }
+};
+
+static string serialize(const Config& cfg, const RcStamp& stamp) {
+    string out;
+    put_raw(out, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    put_raw(out, &stamp, sizeof(stamp));
+
+    put_u32(out, cfg.aliases.size());
+    for (const auto& [name, value] : cfg.aliases) {
+        put_str(out, name);
+        put_str(out, value);
+    }
+    put_u32(out, cfg.variables.size());
+    for (const auto& [name, value] : cfg.variables) {
+        put_str(out, name);
+        put_str(out, value);
+    }
+    put_u32(out, cfg.path_prepend.size());
+    for (const auto& dir : cfg.path_prepend) {
+        put_str(out, dir);
+    }
+
+    put_str(out, cfg.vfs_mount);
+    put_u32(out, cfg.vfs_enabled ? 1 : 0);
+    put_u32(out, cfg.vfs_event_loop ? 1 : 0);
+    put_u32(out, cfg.vfs_writeback_ms);
+    return out;
+}
+
+static bool deserialize(const string& data, const RcStamp& stamp, Config& cfg) {
+    CacheReader in{data};
+
+    char magic[sizeof(CACHE_MAGIC)];
+    RcStamp cached;
+    in.raw(magic, sizeof(magic));
+    in.raw(&cached, sizeof(cached));
+    if (!in.ok || memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 || !(cached == stamp)) {
+        return false;
+    }
+
+    for (uint32_t n = in.u32(); in.ok && n > 0; n--) {
+        string name = in.str();
+        cfg.aliases[name] = in.str();
+    }
+    for (uint32_t n = in.u32(); in.ok && n > 0; n--) {
+        string name = in.str();
+        cfg.variables.emplace_back(name, in.str());
+    }
+    for (uint32_t n = in.u32(); in.ok && n > 0; n--) {
+        cfg.path_prepend.push_back(in.str());
+    }
+
+    cfg.vfs_mount = in.str();
+    cfg.vfs_enabled = in.u32() != 0;
+    cfg.vfs_event_loop = in.u32() != 0;
+    cfg.vfs_writeback_ms = in.u32();
+    return in.ok;
+}
+
+static bool read_file(const string& path, string& data) {
+    ifstream in(path, ios::binary);
+    if (!in) return false;
+    data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    return true;
+}
+
+// Кэш пишется через временный файл и rename: параллельный kubsh не увидит половину
+static void write_cache(const string& data) {
+    mkdir((home_dir() + "/.cache").c_str(), 0755);
+    mkdir(cache_dir().c_str(), 0755);
+
+    string tmp = cache_path() + ".tmp." + to_string(getpid());
+    {
+        ofstream out(tmp, ios::binary | ios::trunc);
+        if (!out) return;
+        out.write(data.data(), data.size());
+        if (!out) {
+            unlink(tmp.c_str());
+            return;
+        }
+    }
+    if (rename(tmp.c_str(), cache_path().c_str()) != 0) {
+        unlink(tmp.c_str());
+    }
+}
+
+// Собирает новый снимок: из кэша, если ~/.kubshrc не менялся, иначе парсит и обновляет кэш.
+// Нет файла - снимок по умолчанию; файл есть, но не читается - nullptr и errno.
+static shared_ptr<Config> build_config() {
+    auto cfg = make_shared<Config>();
+
+    struct stat st;
+    if (stat(rc_path().c_str(), &st) != 0) {
+        return errno == ENOENT ? cfg : nullptr;
+    }
+
+    RcStamp stamp;
+    stamp.ino = st.st_ino;
+    stamp.size = st.st_size;
+    stamp.mtime_sec = st.st_mtim.tv_sec;
+    stamp.mtime_nsec = st.st_mtim.tv_nsec;
+
+    string cached;
+    if (read_file(cache_path(), cached)) {
+        auto from_cache = make_shared<Config>();
+        if (deserialize(cached, stamp, *from_cache)) {
+            return from_cache;
+        }
+    }
+
+    ifstream rc(rc_path());
+    if (!rc) {
+        if (errno == 0) errno = EIO;
+        return nullptr;
+    }
+    parse_rc(rc, *cfg);
+    write_cache(serialize(*cfg, stamp));
+    return cfg;
+}
+
+static void publish(shared_ptr<Config> cfg) {
+    cfg->generation = next_generation++;
+    lock_guard<mutex> lock(config_mutex);
+    config = move(cfg);
+}
+
+// ==================== Горячая перезагрузка ====================
+
+static void reload_thread_function() {
+    // SIGINT/SIGHUP - дело основного потока (или signalfd в событийном цикле)
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+    char bytes[64];
+    while (true) {
+        // Несколько SIGHUP подряд схлопываются в одну пересборку
+        ssize_t n = read(reload_pipe[0], bytes, sizeof(bytes));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+
+        // Сборка идет здесь, основной цикл и FUSE только подхватывают готовый снимок.
+        // Не прочитали файл - остаемся на прежнем снимке.
+        errno = 0;
+        shared_ptr<Config> cfg = build_config();
+        int out = STDOUT_FILENO;
+        string msg = "Configuration reloaded\n";
+        if (cfg) {
+            publish(move(cfg));
+        } else {
+            out = STDERR_FILENO;
+            msg = "kubsh: cannot reload " + rc_path() + ": " + strerror(errno) + "\n";
+        }
+        ssize_t written = write(out, msg.data(), msg.size());
+        (void)written;
+    }
+}
+
+void config_init() {
+    const char* home_env = getenv("HOME");
+    home = home_env ? home_env : "";
+
+    errno = 0;
+    shared_ptr<Config> cfg = build_config();
+    if (!cfg) {
+        cerr << "kubsh: cannot read " << rc_path() << ": " << strerror(errno) << endl;
+        cfg = make_shared<Config>();
+    }
+    publish(move(cfg));
+
+    if (pipe2(reload_pipe, O_CLOEXEC) == 0) {
+        fcntl(reload_pipe[1], F_SETFL, O_NONBLOCK);
+        thread(reload_thread_function).detach();
+    }
+}
+
+shared_ptr<const Config> current_config() {
+    lock_guard<mutex> lock(config_mutex);
+    return config;
+}
+
+void config_request_reload() {
+    if (reload_pipe[1] >= 0) {
+        char byte = 1;
+        // Если пайп полон - перезагрузка уже запрошена
+        ssize_t n = write(reload_pipe[1], &byte, 1);
+        (void)n;
+    }
+}
+
+string expand_alias(const Config& cfg, const string& line) {
+    if (cfg.aliases.empty()) return line;
+
+    size_t end = line.find_first_of(" \t");
+    string word = line.substr(0, end);
+
+    auto it = cfg.aliases.find(word);
+    if (it == cfg.aliases.end()) return line;
+    return end == string::npos ? it->second : it->second + line.substr(end);
+}
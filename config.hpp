@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// ==================== Конфигурация ~/.kubshrc ====================
+//
+// Формат (по одной директиве в строке, # - комментарий):
+//   alias ll=ls -l
+//   export NAME=value        (или просто NAME=value)
+//   path /usr/local/bin      - добавить каталог в начало PATH
+//   set vfs.mount=/opt/users
+//   set vfs.enabled=yes
+//   set vfs.event_loop=no     - FUSE и шелл в одном epoll цикле (как --event-loop)
+//   set vfs.writeback_ms=200
+
+// Скомпилированный неизменяемый снимок конфигурации
+struct Config {
+    std::unordered_map<std::string, std::string> aliases;
+    std::vector<std::pair<std::string, std::string>> variables;  // В порядке файла
+    std::vector<std::string> path_prepend;
+
+    std::string vfs_mount = "/opt/users";
+    bool vfs_enabled = true;
+    bool vfs_event_loop = false;
+    int vfs_writeback_ms = 200;
+
+    uint64_t generation = 0;   // Растет с каждой перезагрузкой
+};
+
+// Загружает ~/.kubshrc: из скомпилированного кэша, если mtime совпадает, иначе парсит
+void config_init();
+
+// Текущий снимок. Дешево, можно звать на каждую команду.
+std::shared_ptr<const Config> current_config();
+
+// Попросить фоновый поток пересобрать конфиг. Безопасно из обработчика сигнала.
+void config_request_reload();
+
+// Подставляет alias вместо первого слова строки
+std::string expand_alias(const Config& config, const std::string& line);
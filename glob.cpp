@@ -0,0 +1,277 @@
+#include "glob.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Буфер getdents64: на большом каталоге - тысячи записей за один вызов
+static const size_t DENTS_BUFFER = 256 * 1024;
+
+// Состояния автомата - биты uint64_t, последний бит - конечное состояние
+static const size_t MAX_GLOB_STEPS = 63;
+
+// ==================== Компиляция шаблона ====================
+
+// Компонент пути в виде NFA, который прогоняется по имени битовыми операциями (Shift-And).
+// Состояние j - "совпали первые j шагов", шаг j (символ, ? или [...]) переводит j -> j + 1,
+// '*' перед шагом j - петля на состоянии j по любому символу.
+struct GlobAutomaton {
+    uint64_t step_mask[256] = {};  // Бит j: шаг j принимает этот символ
+    uint64_t star_loops = 0;       // Бит j: на состоянии j петля '*'
+    uint64_t accept = 0;           // Бит конечного состояния
+    bool leading_dot = false;      // Шаблон начинается с литеральной точки
+};
+
+struct GlobSegment {
+    string text;                   // Литеральный компонент (без \)
+    bool glob = false;
+    bool recursive = false;        // **
+    GlobAutomaton automaton;
+};
+
+bool has_glob_chars(const string& word) {
+    for (size_t i = 0; i < word.size(); i++) {
+        if (word[i] == '\\') {
+            i++;
+        } else if (word[i] == '*' || word[i] == '?' || word[i] == '[') {
+            return true;
+        }
+    }
+    return false;
+}
+
+static string unescape(const string& s) {
+    string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '\\' && i + 1 < s.size()) i++;
+        out += s[i];
+    }
+    return out;
+}
+
+// [abc], [a-z], [!a-z]. Незакрытая скобка - обычный символ '['.
+static bool parse_class(const string& p, size_t& pos, uint64_t bit, GlobAutomaton& a) {
+    size_t i = pos + 1;
+    bool negate = i < p.size() && (p[i] == '!' || p[i] == '^');
+    if (negate) i++;
+
+    bool chars[256] = {};
+    bool first = true;
+    while (i < p.size() && (p[i] != ']' || first)) {
+        first = false;
+        unsigned char lo = p[i];
+        if (i + 2 < p.size() && p[i + 1] == '-' && p[i + 2] != ']') {
+            unsigned char hi = p[i + 2];
+            for (unsigned c = lo; c <= hi; c++) chars[c] = true;
+            i += 3;
+        } else {
+            chars[lo] = true;
+            i++;
+        }
+    }
+    if (i >= p.size()) return false;
+
+    for (unsigned c = 0; c < 256; c++) {
+        if (chars[c] != negate) a.step_mask[c] |= bit;
+    }
+    pos = i + 1;
+    return true;
+}
+
+// false - шаблон слишком длинный для автомата, слово остается как есть
+static bool compile_segment(const string& seg, GlobAutomaton& a) {
+    size_t steps = 0;
+    size_t i = 0;
+    while (i < seg.size()) {
+        char c = seg[i];
+        if (c == '*') {
+            a.star_loops |= 1ull << steps;
+            i++;
+            continue;
+        }
+        if (steps == MAX_GLOB_STEPS) return false;
+
+        uint64_t bit = 1ull << steps;
+        if (c == '?') {
+            for (unsigned ch = 0; ch < 256; ch++) a.step_mask[ch] |= bit;
+            i++;
+        } else if (c != '[' || !parse_class(seg, i, bit, a)) {
+            if (c == '\\' && i + 1 < seg.size()) c = seg[++i];
+            a.step_mask[(unsigned char) c] |= bit;
+            if (steps == 0 && c == '.' && a.star_loops == 0) a.leading_dot = true;
+            i++;
+        }
+        steps++;
+    }
+    a.accept = 1ull << steps;
+    return true;
+}
+
+static bool glob_match(const GlobAutomaton& a, const string& name) {
+    if (name[0] == '.' && !a.leading_dot) return false;
+
+    uint64_t state = 1;
+    for (unsigned char c : name) {
+        state = ((state & a.step_mask[c]) << 1) | (state & a.star_loops);
+        if (state == 0) return false;
+    }
+    return (state & a.accept) != 0;
+}
+
+// ==================== Листинг каталогов ====================
+
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Читает каталог целиком большими порциями getdents64, без readdir на каждую запись.
+// Повторные обращения в той же командной строке берут готовый список.
+static const vector<DirEntry>& list_dir(GlobCache& cache, const string& dir) {
+    auto it = cache.dirs.find(dir);
+    if (it != cache.dirs.end()) return it->second;
+
+    vector<DirEntry>& entries = cache.dirs[dir];
+    int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return entries;
+
+    static vector<char> buf(DENTS_BUFFER);
+    while (true) {
+        long n = syscall(SYS_getdents64, fd, buf.data(), buf.size());
+        if (n <= 0) break;
+
+        for (long pos = 0; pos < n;) {
+            auto* d = reinterpret_cast<LinuxDirent64*>(buf.data() + pos);
+            if (strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0) {
+                entries.push_back({d->d_name, d->d_type});
+            }
+            pos += d->d_reclen;
+        }
+    }
+    close(fd);
+    return entries;
+}
+
+static string join(const string& prefix, const string& name) {
+    if (prefix.empty()) return name;
+    if (prefix.back() == '/') return prefix + name;
+    return prefix + "/" + name;
+}
+
+// Тип обычно известен из getdents64; stat - только для DT_UNKNOWN и ссылок
+static bool is_dir(const string& path, unsigned char type, bool follow_links) {
+    if (type == DT_DIR) return true;
+    if (type != DT_UNKNOWN && !(type == DT_LNK && follow_links)) return false;
+
+    struct stat st;
+    int rc = follow_links ? stat(path.c_str(), &st) : lstat(path.c_str(), &st);
+    return rc == 0 && S_ISDIR(st.st_mode);
+}
+
+// ==================== Раскрытие ====================
+
+static void expand_from(GlobCache& cache, const vector<GlobSegment>& segs, size_t i,
+                        const string& prefix, vector<string>& out) {
+    if (i == segs.size()) {
+        out.push_back(prefix);
+        return;
+    }
+
+    const GlobSegment& seg = segs[i];
+    bool last = (i + 1 == segs.size());
+
+    if (seg.recursive) {
+        // ** - ноль каталогов, затем рекурсивно в каждый подкаталог (по ссылкам не ходим)
+        if (!last) expand_from(cache, segs, i + 1, prefix, out);
+        for (const DirEntry& entry : list_dir(cache, prefix)) {
+            if (entry.name[0] == '.') continue;
+            string path = join(prefix, entry.name);
+            if (last) out.push_back(path);
+            if (is_dir(path, entry.type, false)) expand_from(cache, segs, i, path, out);
+        }
+        return;
+    }
+
+    if (!seg.glob) {
+        // Литеральный компонент каталог не читает; в конце пути - проверка существования
+        string path = join(prefix, seg.text);
+        if (!last) {
+            expand_from(cache, segs, i + 1, path, out);
+        } else {
+            struct stat st;
+            if (lstat(path.c_str(), &st) == 0) out.push_back(path);
+        }
+        return;
+    }
+
+    for (const DirEntry& entry : list_dir(cache, prefix)) {
+        if (!glob_match(seg.automaton, entry.name)) continue;
+        string path = join(prefix, entry.name);
+        if (last) {
+            out.push_back(path);
+        } else if (is_dir(path, entry.type, true)) {
+            expand_from(cache, segs, i + 1, path, out);
+        }
+    }
+}
+
+static bool expand_word(GlobCache& cache, const string& word, vector<string>& out) {
+    // Кавычки токенизатор не снимает - такое слово считаем литералом
+    if (word.find_first_of("'\"") != string::npos) return false;
+
+    string prefix;
+    size_t pos = 0;
+    if (word[0] == '/') {
+        prefix = "/";
+        pos = 1;
+    }
+
+    vector<GlobSegment> segs;
+    while (true) {
+        size_t slash = word.find('/', pos);
+        string text = word.substr(pos, slash == string::npos ? string::npos : slash - pos);
+
+        GlobSegment seg;
+        if (text == "**") {
+            seg.recursive = true;
+        } else if (has_glob_chars(text)) {
+            seg.glob = true;
+            if (!compile_segment(text, seg.automaton)) return false;
+        } else {
+            seg.text = unescape(text);
+        }
+        segs.push_back(move(seg));
+
+        if (slash == string::npos) break;
+        pos = slash + 1;
+    }
+
+    size_t first = out.size();
+    expand_from(cache, segs, 0, prefix, out);
+
+    sort(out.begin() + first, out.end());
+    out.erase(unique(out.begin() + first, out.end()), out.end());
+    return out.size() > first;
+}
+
+void expand_globs(vector<string>& args, GlobCache& cache) {
+    if (none_of(args.begin(), args.end(), has_glob_chars)) return;
+
+    vector<string> result;
+    for (const string& arg : args) {
+        if (!has_glob_chars(arg) || !expand_word(cache, arg, result)) {
+            result.push_back(arg);
+        }
+    }
+    args.swap(result);
+}
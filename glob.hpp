@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ==================== Раскрытие шаблонов имен файлов ====================
+//
+// *, ?, [abc], [a-z], [!abc] - в пределах одного компонента пути,
+// ** отдельным компонентом - ноль или больше каталогов (рекурсивно).
+// Имена на точку совпадают только с шаблоном, который сам начинается с точки.
+
+// Одна запись каталога из getdents64
+struct DirEntry {
+    std::string name;
+    unsigned char type;       // DT_DIR, DT_REG, ... или DT_UNKNOWN
+};
+
+// Листинги каталогов, прочитанные за время одной командной строки.
+// Каждый каталог читается один раз, сколько бы шаблонов к нему ни обращались.
+struct GlobCache {
+    std::unordered_map<std::string, std::vector<DirEntry>> dirs;
+};
+
+bool has_glob_chars(const std::string& word);
+
+// Заменяет каждое слово-шаблон отсортированным списком совпадений.
+// Слово без совпадений остается как есть (как в sh).
+void expand_globs(std::vector<std::string>& args, GlobCache& cache);
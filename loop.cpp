@@ -0,0 +1,223 @@
+#include "loop.hpp"
+#include "trace.hpp"
+#include "vfs.hpp"
+
+#include <atomic>
+#include <thread>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Что пришло из epoll
+enum LoopTag : uint64_t {
+    TAG_STDIN = 1,
+    TAG_SIGNAL,
+    TAG_FUSE,
+    TAG_CHILD,
+};
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static atomic<int> fuse_fd{-1};
+// Монтирование идет в фоне и не задерживает первое приглашение
+static thread mount_thread;
+static void (*signal_callback)(int) = nullptr;
+
+// Ввод читается кусками, строки выдаются по одной
+static string input_buffer;
+static bool input_eof = false;
+// stdin - обычный файл или /dev/null: epoll такие не принимает, читаем напрямую
+static bool stdin_pollable = true;
+
+static sigset_t loop_signals() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGHUP);
+    return set;
+}
+
+void loop_block_signals() {
+    sigset_t set = loop_signals();
+    sigprocmask(SIG_BLOCK, &set, nullptr);
+}
+
+static bool epoll_add(int fd, uint64_t tag) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = tag;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+// Пока работает ребенок, ввод не читаем: он может быть нужен самому ребенку
+static void set_stdin_interest(bool on) {
+    if (!stdin_pollable) return;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = on ? (uint32_t) EPOLLIN : 0;
+    ev.data.u64 = TAG_STDIN;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, STDIN_FILENO, &ev);
+}
+
+bool loop_init(const string& mountpoint, void (*on_signal)(int)) {
+    signal_callback = on_signal;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) return false;
+
+    sigset_t set = loop_signals();
+    signal_fd = signalfd(-1, &set, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (signal_fd < 0 || !epoll_add(signal_fd, TAG_SIGNAL)) {
+        loop_shutdown();
+        return false;
+    }
+
+    if (!epoll_add(STDIN_FILENO, TAG_STDIN)) {
+        stdin_pollable = false;
+    }
+
+    if (!mountpoint.empty()) {
+        // epoll_ctl потокобезопасен: fd сессии добавится в цикл, как только будет готов
+        mount_thread = thread([mountpoint] {
+            TracePhase trace("vfs mount");
+            int fd = vfs_session_start(mountpoint);
+            if (fd >= 0 && epoll_add(fd, TAG_FUSE)) {
+                fuse_fd = fd;
+            }
+        });
+    }
+    return true;
+}
+
+bool loop_active() {
+    return epoll_fd >= 0;
+}
+
+static void read_input() {
+    char buf[4096];
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n < 0) {
+        if (errno != EINTR && errno != EAGAIN) input_eof = true;
+        return;
+    }
+    if (n == 0) {
+        input_eof = true;
+        return;
+    }
+    input_buffer.append(buf, n);
+}
+
+static void read_signals() {
+    struct signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (signal_callback) signal_callback(info.ssi_signo);
+    }
+}
+
+// Один проход: ждем событий и разбираем их. Возвращает true, если завершился ребенок.
+static bool loop_iteration() {
+    struct epoll_event events[16];
+    int n = epoll_wait(epoll_fd, events, 16, -1);
+    if (n < 0) return false;
+
+    bool child_done = false;
+    for (int i = 0; i < n; i++) {
+        switch (events[i].data.u64) {
+        case TAG_STDIN:
+            read_input();
+            break;
+        case TAG_SIGNAL:
+            read_signals();
+            break;
+        case TAG_FUSE:
+            // Быстрые запросы (getattr/read/readdir) - прямо здесь.
+            // Сессию размонтировали снаружи - убираем fd, иначе epoll будет будить вечно.
+            if (!vfs_session_process()) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fuse_fd, nullptr);
+            }
+            break;
+        case TAG_CHILD:
+            child_done = true;
+            break;
+        }
+    }
+    return child_done;
+}
+
+bool loop_read_line(string& line, volatile sig_atomic_t& running) {
+    while (true) {
+        size_t pos = input_buffer.find('\n');
+        if (pos != string::npos) {
+            line = input_buffer.substr(0, pos);
+            input_buffer.erase(0, pos + 1);
+            return true;
+        }
+        if (input_eof) {
+            if (input_buffer.empty()) return false;
+            line.swap(input_buffer);
+            input_buffer.clear();
+            return true;
+        }
+        if (!running) return false;
+
+        if (stdin_pollable) {
+            loop_iteration();
+        } else {
+            read_input();
+        }
+    }
+}
+
+int loop_wait_child(pid_t pid) {
+    int status = 0;
+
+#ifdef SYS_pidfd_open
+    int pidfd = (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    int pidfd = -1;
+#endif
+    if (pidfd < 0 || !epoll_add(pidfd, TAG_CHILD)) {
+        // Ядро без pidfd - ждем по-старому
+        if (pidfd >= 0) close(pidfd);
+        waitpid(pid, &status, 0);
+        return status;
+    }
+
+    set_stdin_interest(false);
+    while (!loop_iteration()) {
+    }
+    set_stdin_interest(true);
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, pidfd, nullptr);
+    close(pidfd);
+    waitpid(pid, &status, 0);
+    return status;
+}
+
+void loop_shutdown() {
+    if (mount_thread.joinable()) {
+        mount_thread.join();
+    }
+    if (fuse_fd >= 0) {
+        vfs_session_stop();
+        fuse_fd = -1;
+    }
+    if (signal_fd >= 0) {
+        close(signal_fd);
+        signal_fd = -1;
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <csignal>
+#include <string>
+#include <sys/types.h>
+
+// ==================== Единый событийный цикл ====================
+//
+// Один epoll на ввод терминала, signalfd, pidfd дочерних процессов и fd сессии FUSE.
+// Включается ключом --event-loop или "set vfs.event_loop=yes" в ~/.kubshrc.
+
+// Блокирует SIGINT/SIGTERM/SIGHUP - дальше они приходят через signalfd.
+// Вызывать до запуска любых потоков.
+void loop_block_signals();
+
+// Создает epoll и signalfd, монтирует VFS (если mountpoint не пуст).
+// on_signal вызывается из цикла (не из обработчика сигнала).
+bool loop_init(const std::string& mountpoint, void (*on_signal)(int));
+
+bool loop_active();
+
+// Ждет полную строку ввода, обслуживая FUSE и сигналы. false - EOF или running сброшен.
+bool loop_read_line(std::string& line, volatile sig_atomic_t& running);
+
+// Ждет завершения ребенка через pidfd, обслуживая FUSE и сигналы. Возвращает status как waitpid.
+int loop_wait_child(pid_t pid);
+
+// Размонтирует VFS и закрывает дескрипторы цикла
+void loop_shutdown();
@@ -18,8 +18,20 @@
 #include <dirent.h>
 #include <cstring>
 #include <cstdint>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <algorithm>
 
 #include "vfs.hpp"
+#include "redirect.hpp"
+#include "config.hpp"
+#include "loop.hpp"
+#include "trace.hpp"
+#include "glob.hpp"
+#include "script.hpp"
 
 using namespace std;
 
@@ -27,12 +39,20 @@ using namespace std;
 volatile sig_atomic_t sighup_received = 0;
 volatile sig_atomic_t running = true;
 
+// Точка монтирования VFS (set vfs.mount в ~/.kubshrc)
+string vfs_dir = "/opt/users";
+
+// Действующий снимок ~/.kubshrc и файл истории - нужны и циклу, и run_command
+shared_ptr<const Config> config;
+string history_file;
+
 // ==================== Функции для работы с сигналами ====================
 void handle_sighup(int signum) {
     (void)signum;
-    const char* msg = "Configuration reloaded\n";
-    write(STDOUT_FILENO, msg, strlen(msg));
     sighup_received = 1;
+    // Сама пересборка идет в фоновом потоке, обработчик только будит его.
+    // "Configuration reloaded" (или ошибку) поток пишет, когда снимок уже подменен.
+    config_request_reload();
 }
 
 void handle_signal(int signum) {
@@ -41,6 +61,15 @@ void handle_signal(int signum) {
     }
 }
 
+// В режиме событийного цикла сигналы приходят через signalfd
+void handle_loop_signal(int signum) {
+    if (signum == SIGHUP) {
+        handle_sighup(signum);
+    } else {
+        handle_signal(signum);
+    }
+}
+
 // ==================== Вспомогательные функции ====================
 bool file_exists(const string& path) {
     struct stat buffer;
@@ -67,6 +96,55 @@ bool create_directory(const string& path) {
     return mkdir(path.c_str(), 0755) == 0;
 }
 
+// ==================== Хэш команд из PATH ====================
+
+// Имя команды -> полный путь. Строится в фоне при старте и при смене PATH,
+// чтобы не делать stat по каждому каталогу PATH на каждую команду.
+typedef unordered_map<string, string> PathHash;
+
+mutex path_hash_mutex;
+shared_future<shared_ptr<const PathHash>> path_hash;
+// PATH, по которому строился хэш. PATH меняют и конфиг, и PATH=/export в сценариях -
+// при расхождении хэш не используется и перестраивается.
+string path_hash_key;
+
+shared_ptr<const PathHash> build_path_hash(const string& path_env) {
+    TracePhase trace("path hash");
+    auto hash = make_shared<PathHash>();
+    
+    stringstream ss(path_env);
+    string dir_path;
+    while (getline(ss, dir_path, ':')) {
+        if (dir_path.empty()) continue;
+        
+        DIR* dir = opendir(dir_path.c_str());
+        if (!dir) continue;
+        
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (entry->d_name[0] == '.') continue;
+            // Первый каталог в PATH выигрывает - как при обычном поиске
+            hash->emplace(entry->d_name, dir_path + "/" + entry->d_name);
+        }
+        closedir(dir);
+    }
+    return hash;
+}
+
+// Вызывается под path_hash_mutex
+static void start_rehash(const string& path) {
+    path_hash_key = path;
+    path_hash = async(launch::async, build_path_hash, path).share();
+}
+
+void rehash_path() {
+    const char* path_env = getenv("PATH");
+    string path = path_env ? path_env : "";
+    
+    lock_guard<mutex> lock(path_hash_mutex);
+    start_rehash(path);
+}
+
 string find_in_path(const string& cmd) {
     if (cmd.find('/') != string::npos) {
         if (file_exists(cmd)) {
@@ -78,6 +156,23 @@ string find_in_path(const string& cmd) {
     const char* path_env = getenv("PATH");
     if (!path_env) return "";
     
+    // Хэш еще строится или построен по старому PATH - не ждем его, ищем обычным способом
+    shared_future<shared_ptr<const PathHash>> hash;
+    {
+        lock_guard<mutex> lock(path_hash_mutex);
+        if (path_hash_key == path_env) {
+            hash = path_hash;
+        } else {
+            start_rehash(path_env);
+        }
+    }
+    if (hash.valid() && hash.wait_for(chrono::seconds(0)) == future_status::ready) {
+        auto it = hash.get()->find(cmd);
+        if (it != hash.get()->end() && file_exists(it->second)) {
+            return it->second;
+        }
+    }
+    
     stringstream ss(path_env);
     string path;
     
@@ -106,11 +201,11 @@ string exec(const char* cmd) {
 }
 
 // ==================== Функции для работы с дисками ====================
-void check_disk_partitions(const string& device_path) {
+void check_disk_partitions(const string& device_path, const IoTarget& io) {
     ifstream device(device_path, ios::binary);
 
     if (!device) {
-        cout << "Error: Cannot open device " << device_path << "\n";
+        emit(io, "Error: Cannot open device " + device_path + "\n");
         return;
     }
     
@@ -118,15 +213,17 @@ void check_disk_partitions(const string& device_path) {
     device.read(sector, 512);
     
     if (device.gcount() != 512) {
-        cout << "Error: Cannot read disk\n";
+        emit(io, "Error: Cannot read disk\n");
         return;
     }
     
     if ((unsigned char)sector[510] != 0x55 || (unsigned char)sector[511] != 0xAA) {
-        cout << "Error: Invalid disk signature\n";
+        emit(io, "Error: Invalid disk signature\n");
         return;
     }
     
+    ostringstream out;
+    
     bool is_gpt = false;
     for (int i = 0; i < 4; i++) {
         if ((unsigned char)sector[446 + i * 16 + 4] == 0xEE) {
@@ -145,8 +242,8 @@ void check_disk_partitions(const string& device_path) {
                 uint32_t size_mb = num_sectors / 2048;
                 bool bootable = ((unsigned char)sector[offset] == 0x80);
                 
-                cout << "Partition " << (i + 1) << ": Size=" << size_mb << "MB, Bootable: ";
-                cout << (bootable ? "Yes\n" : "No\n");
+                out << "Partition " << (i + 1) << ": Size=" << size_mb << "MB, Bootable: ";
+                out << (bootable ? "Yes\n" : "No\n");
             }
         }
     } else {
@@ -155,22 +252,32 @@ void check_disk_partitions(const string& device_path) {
             sector[0] == 'E' && sector[1] == 'F' && sector[2] == 'I' && sector[3] == ' ' && 
             sector[4] == 'P' && sector[5] == 'A' && sector[6] == 'R' && sector[7] == 'T') {
             uint32_t num_partitions = *(uint32_t*)&sector[80];
-            cout << "GPT partitions: " << num_partitions << "\n";
+            out << "GPT partitions: " << num_partitions << "\n";
         } else {
-            cout << "GPT partitions: unknown\n";
+            out << "GPT partitions: unknown\n";
         }
     }
+    
+    emit(io, out.str());
 }
 
 // ==================== Функции для выполнения команд ====================
-bool execute_external(const vector<string>& args) {
-    if (args.empty()) return false;
+// Код возврата команды (128 + сигнал, если убита), -1 - команда не найдена
+int execute_external(const vector<string>& args, const IoTarget& io) {
+    if (args.empty()) return -1;
     
     string cmd_path = find_in_path(args[0]);
-    if (cmd_path.empty()) return false;
+    if (cmd_path.empty()) return -1;
     
     pid_t pid = fork();
     if (pid == 0) {
+        apply_redirections_in_child(io);
+        
+        // В режиме событийного цикла сигналы заблокированы - ребенку они нужны
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, nullptr);
+        
         vector<char*> exec_args;
         for (const auto& arg : args) {
             exec_args.push_back(const_cast<char*>(arg.c_str()));
@@ -181,11 +288,17 @@ bool execute_external(const vector<string>& args) {
         exit(127);
     } else if (pid > 0) {
         int status;
-        waitpid(pid, &status, 0);
-        return true;
+        if (loop_active()) {
+            // Пока ждем, цикл продолжает обслуживать FUSE и сигналы
+            status = loop_wait_child(pid);
+        } else {
+            waitpid(pid, &status, 0);
+        }
+        if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+        return WEXITSTATUS(status);
     }
     
-    return false;
+    return -1;
 }
 
 void execute_external_legacy(const string& input) {
@@ -219,7 +332,6 @@ void execute_external_legacy(const string& input) {
 
 // ==================== Функции для работы с VFS ====================
 void create_user_vfs_info(const string& username) {
-    string vfs_dir = "/opt/users";
     string user_dir = vfs_dir + "/" + username;
     
     if (!create_directory(user_dir)) {
@@ -270,8 +382,11 @@ void create_user_vfs_info(const string& username) {
     }
 }
 
+// Выход не ждет синхронизации всех пользователей - она прерывается на следующем
+atomic<bool> vfs_sync_cancelled{false};
+
 void init_vfs() {
-    string vfs_dir = "/opt/users";
+    TracePhase trace("vfs user sync");
     
     if (!create_directory(vfs_dir)) {
         cerr << "Failed to create VFS directory: " << vfs_dir << endl;
@@ -281,7 +396,7 @@ void init_vfs() {
     ifstream passwd_file("/etc/passwd");
     if (passwd_file) {
         string line;
-        while (getline(passwd_file, line)) {
+        while (!vfs_sync_cancelled && getline(passwd_file, line)) {
             if (line.find("/bin/bash") != string::npos || line.find("/bin/sh") != string::npos) {
                 vector<string> parts;
                 stringstream ss(line);
@@ -332,28 +447,23 @@ void handle_user_deletion(const string& username) {
 }
 
 // ==================== Обработка встроенных команд ====================
-void process_history(const string& history_file) {
-    ifstream history_in(history_file);
-    string line;
-    while (getline(history_in, line)) {
-        cout << line << "\n";
-    }
+void process_history(const string& history_file, const IoTarget& io) {
+    // Файл истории отдается целиком через sendfile/splice без построчного чтения
+    emit_file(io, history_file);
 }
 
-void process_debug(const string& input) {
-    cout << input.substr(7, input.length() - 8) << endl;
+void process_debug(const string& input, const IoTarget& io) {
+    emit(io, input.substr(7, input.length() - 8) + "\n");
 }
 
-void process_echo(const string& input) {
+void process_echo(const string& input, const IoTarget& io) {
     if (input.substr(0, 7) == "debug '" && input[input.length() - 1] == '\'') {
-        process_debug(input);
+        process_debug(input, io);
         return;
     }
     
-    string result;
-    for (size_t i = 1; i < input.length(); ++i) {
-        result += input[i];
-    }
+    // Пропускаем "echo "
+    string result = input.substr(5);
     
     if (result.size() >= 2) {
         char first = result[0];
@@ -363,10 +473,10 @@ void process_echo(const string& input) {
         }
     }
     
-    cout << result << endl;
+    emit(io, result + "\n");
 }
 
-void process_env_var(const string& varName) {
+void process_env_var(const string& varName, const IoTarget& io) {
     const char* value = getenv(varName.c_str());
     
     if(value != nullptr) {
@@ -380,50 +490,302 @@ void process_env_var(const string& varName) {
         }
         
         if (has_colon) {
-            string current_part = "";
+            string out;
             for (char c : valueStr) {
-                if (c == ':') {
-                    cout << current_part << "\n";
-                    current_part = "";
-                } else {
-                    current_part += c;
-                }
+                out += (c == ':') ? '\n' : c;
             }
-            cout << current_part << "\n";
+            emit(io, out + "\n");
         } else {
-            cout << valueStr << "\n";
+            emit(io, valueStr + "\n");
         }
     } else {
-        cout << varName << ": не найдено\n";
+        emit(io, varName + ": не найдено\n");
     }
 }
 
-void process_disk_info(const string& device_path) {
+void process_disk_info(const string& device_path, const IoTarget& io) {
     string trimmed_path = device_path;
     trimmed_path.erase(0, trimmed_path.find_first_not_of(" \t"));
     trimmed_path.erase(trimmed_path.find_last_not_of(" \t") + 1);
     
     if (trimmed_path.empty()) {
-        cout << "Usage: \\l /dev/device_name (e.g., \\l /dev/sda)\n";
+        emit(io, "Usage: \\l /dev/device_name (e.g., \\l /dev/sda)\n");
     } else {
-        check_disk_partitions(trimmed_path);
+        check_disk_partitions(trimmed_path, io);
+    }
+}
+
+// vfsstat - статистика операций VFS, vfsstat -r - вывести и обнулить
+void process_vfs_stats(const vector<string>& args, const IoTarget& io) {
+    emit(io, vfs_stats_report());
+    if (args.size() > 1 && args[1] == "-r") {
+        vfs_stats_reset();
+    }
+}
+
+// ==================== Конфигурация ====================
+
+// Каталоги path из конфига ставятся в начало текущего PATH. Добавленные прошлым
+// снимком сначала убираем (по первому вхождению), так что export PATH=... между
+// перезагрузками сохраняется, а повторный SIGHUP не наращивает PATH.
+static string merge_path(const string& current, const vector<string>& removed, const vector<string>& added) {
+    vector<string> left = removed;
+    string path;
+    size_t pos = 0;
+    while (pos <= current.size() && !current.empty()) {
+        size_t colon = current.find(':', pos);
+        if (colon == string::npos) colon = current.size();
+        string dir = current.substr(pos, colon - pos);
+        pos = colon + 1;
+
+        auto it = find(left.begin(), left.end(), dir);
+        if (it != left.end()) {
+            left.erase(it);
+            continue;
+        }
+        path += (path.empty() ? "" : ":") + dir;
+    }
+    for (auto it = added.rbegin(); it != added.rend(); ++it) {
+        path = *it + (path.empty() ? "" : ":" + path);
+    }
+    return path;
+}
+
+// Переменные окружения процесса меняем только из основного потока,
+// поэтому готовый снимок применяется здесь, а не в потоке перезагрузки.
+// previous - снимок, примененный до этого (nullptr при запуске).
+void apply_config(const Config& config, const Config* previous) {
+    const char* current = getenv("PATH");
+    static const vector<string> nothing;
+    string path = merge_path(current ? current : "", previous ? previous->path_prepend : nothing,
+                             config.path_prepend);
+    setenv("PATH", path.c_str(), 1);
+    
+    for (const auto& [name, value] : config.variables) {
+        setenv(name.c_str(), value.c_str(), 1);
+    }
+    
+    // PATH мог поменяться - пересобираем хэш команд в фоне
+    rehash_path();
+    
+    vfs_set_writeback_delay(config.vfs_writeback_ms);
+}
+
+// ==================== История ====================
+
+struct HistoryState {
+    vector<string> entries;
+    ofstream out;
+};
+
+// Загрузка прошлой истории и открытие файла на дозапись - в фоне, параллельно с остальным запуском
+HistoryState load_history(const string& history_file) {
+    TracePhase trace("history");
+    HistoryState state;
+    
+    ifstream in(history_file);
+    string line;
+    while (getline(in, line)) {
+        state.entries.push_back(line);
+    }
+    
+    state.out.open(history_file, ios::app);
+    return state;
+}
+
+// ==================== Выполнение строки ====================
+
+// Одна простая команда: перенаправления, alias, встроенные команды, внешние программы.
+// Сюда же приходят команды из сценариев - уже после подстановки переменных.
+int run_command(const string& line) {
+    // Перенаправления: вырезаем из строки и открываем файлы до запуска команды
+    vector<Redirection> redirs;
+    string command, redir_error;
+    if (!split_redirections(line, command, redirs, redir_error)) {
+        cerr << "kubsh: " << redir_error << endl;
+        return 2;
+    }
+    
+    IoTarget io;
+    if (!open_redirections(redirs, io)) return 1;
+    string input = expand_alias(*config, command);
+    
+    // Встроенная команда может сама обратиться к точке монтирования -
+    // на это время запросы FUSE читает поток подкачки
+    vfs_session_pump(true);
+    int status = 0;
+    
+    // Обработка специальных команд
+    if (input.empty()) {
+        // Только перенаправление ("> file") - файл уже создан
+    }
+    else if (input == "history") {
+        process_history(history_file, io);
+    }
+    else if (input == "\\q") {
+        // Интерпретатор сценариев видит сброшенный флаг и останавливается
+        running = false;
+    }
+    else if (input.substr(0, 3) == "\\l ") {
+        process_disk_info(input.substr(3), io);
+    }
+    else if (input.substr(0, 7) == "debug '" && input[input.length() - 1] == '\'') {
+        process_debug(input, io);
+    }
+    else if (input.substr(0,4) == "\\e $") {
+        process_env_var(input.substr(4), io);
+    }
+    else if (input.substr(0, 5) == "echo ") {
+        process_echo(input, io);
+    }
+    else {
+        // Разбиваем ввод на аргументы
+        vector<string> args;
+        stringstream ss(input);
+        string token;
+        while (ss >> token) {
+            args.push_back(token);
+        }
+        
+        // *, ?, [...] и **: каждый каталог читается один раз на всю строку
+        GlobCache glob_cache;
+        expand_globs(args, glob_cache);
+        
+        // Обработка команд управления файлами
+        if (args.empty()) {
+        }
+        else if (args[0] == "cat" && args.size() > 1 && args[1] == "/etc/passwd") {
+            if (!emit_file(io, "/etc/passwd")) {
+                emit(io, "cat: /etc/passwd: No such file or directory\n");
+                status = 1;
+            }
+        }
+        else if (args[0] == "vfsstat") {
+            process_vfs_stats(args, io);
+        }
+        else if (args[0] == "mkdir" && args.size() > 1) {
+            string dir_path = args[1];
+            if (dir_path.find(vfs_dir + "/") == 0) {
+                string username = dir_path.substr(vfs_dir.size() + 1);
+                if (!username.empty() && username.find('/') == string::npos) {
+                    create_user_vfs_info(username);
+                    emit(io, "Created VFS directory for user: " + username + "\n");
+                } else {
+                    create_directory(dir_path);
+                }
+            } else {
+                create_directory(dir_path);
+            }
+        }
+        else if (args[0] == "ls" && args.size() > 1 && args[1] == vfs_dir) {
+            if (dir_exists(vfs_dir)) {
+                DIR* dir = opendir(vfs_dir.c_str());
+                if (dir) {
+                    string out;
+                    struct dirent* entry;
+                    while ((entry = readdir(dir)) != nullptr) {
+                        if (entry->d_name[0] != '.') {
+                            string full_path = vfs_dir + "/" + entry->d_name;
+                            if (dir_exists(full_path)) {
+                                out += entry->d_name;
+                                out += '\n';
+                            }
+                        }
+                    }
+                    closedir(dir);
+                    emit(io, out);
+                }
+            } else {
+                emit(io, "ls: cannot access '" + vfs_dir + "': No such file or directory\n");
+            }
+        }
+        else if (args[0] == "rmdir" && args.size() > 1) {
+            string dir_path = args[1];
+            if (dir_path.find(vfs_dir + "/") == 0) {
+                string username = dir_path.substr(vfs_dir.size() + 1);
+                if (!username.empty() && username.find('/') == string::npos) {
+                    handle_user_deletion(username);
+                    string cmd = "rm -rf \"" + dir_path + "\"";
+                    system(cmd.c_str());
+                    emit(io, "Removed VFS directory and user: " + username + "\n");
+                } else {
+                    rmdir(dir_path.c_str());
+                }
+            } else {
+                rmdir(dir_path.c_str());
+            }
+        }
+        else {
+            // Выполнение внешней команды
+            status = execute_external(args, io);
+            if (status < 0) {
+                cout << args[0] << ": command not found" << endl;
+                status = 127;
+            }
+        }
     }
+    
+    vfs_session_pump(false);
+    close_redirections(io);
+    cout.flush();
+    return status;
 }
 
 // ==================== Основная функция ====================
-int main() {
+int main(int argc, char* argv[]) {
     cout << unitbuf;
     cerr << unitbuf;
     
-    // Запуск FUSE
-    fuse_start();
+    bool event_loop = false;
+    string script_path;
+    vector<string> script_args;
+    for (int i = 1; i < argc; i++) {
+        if (!script_path.empty()) {
+            // Все после имени сценария - его аргументы
+            script_args.push_back(argv[i]);
+        } else if (strcmp(argv[i], "--event-loop") == 0) {
+            event_loop = true;
+        } else if (strcmp(argv[i], "--startup-trace") == 0) {
+            trace_enable();
+        } else {
+            script_path = argv[i];
+        }
+    }
+    
+    // Все, что не нужно для первого приглашения, запускается в фоне:
+    // монтирование, синхронизация пользователей, хэш PATH, загрузка истории.
+    
+    // ~/.kubshrc (из скомпилированного кэша, если файл не менялся)
+    {
+        TracePhase trace("config");
+        config_init();
+        config = current_config();
+        apply_config(*config, nullptr);
+    }
+    vfs_dir = config->vfs_mount;
+    event_loop = event_loop || config->vfs_event_loop;
+    
+    // Запуск FUSE: в едином цикле с шеллом или в отдельном потоке.
+    // В обоих режимах само монтирование не задерживает приглашение.
+    if (event_loop) {
+        TracePhase trace("event loop");
+        loop_block_signals();
+        if (!loop_init(config->vfs_enabled ? vfs_dir : "", handle_loop_signal)) {
+            cerr << "kubsh: cannot start event loop: " << strerror(errno) << endl;
+            return 1;
+        }
+    } else if (config->vfs_enabled) {
+        TracePhase trace("fuse thread");
+        fuse_start(vfs_dir);
+    }
     
     vector<string> history;
     string input;
     
     const char* home = getenv("HOME");
-    string history_file = string(home) + "/.kubsh_history";
-    ofstream history_out(history_file, ios::app);
+    history_file = string(home) + "/.kubsh_history";
+    ofstream history_out;
+    future<HistoryState> history_job = async(launch::async, load_history, history_file);
     
     // Установка обработчиков сигналов
     signal(SIGHUP, handle_sighup);
@@ -431,22 +793,64 @@ int main() {
     signal(SIGTERM, handle_signal);
     
     // Инициализация VFS
-    init_vfs();
+    thread vfs_sync_thread;
+    if (config->vfs_enabled) {
+        vfs_sync_thread = thread(init_vfs);
+    }
+    
+    script_init(run_command, &running);
+    int exit_status = 0;
+    string script_text;
+    
+    // kubsh script.sh arg... - выполнить сценарий вместо интерактивного цикла
+    // Сценарий сам обращается к ФС ([ -d ], шаблоны for, > file, source) вне run_command,
+    // а в режиме цикла FUSE на это время обслуживает только поток подкачки
+    if (!script_path.empty()) {
+        vfs_session_pump(true);
+        exit_status = script_run_file(script_path, script_args).status;
+        vfs_session_pump(false);
+        running = false;
+    }
+    
+    bool first_prompt = true;
     
     // Основной цикл
     while (running) {
         if (isatty(STDIN_FILENO)) {
-            cout << "kubsh> ";
+            cout << (script_text.empty() ? "kubsh> " : "> ");
         }
         cout.flush();
         
-        if (!getline(cin, input)) {
+        if (first_prompt) {
+            trace_mark("first prompt");
+            first_prompt = false;
+        }
+        
+        if (loop_active()) {
+            if (!loop_read_line(input, running)) break;
+        } else if (!getline(cin, input)) {
             if (cin.eof()) break;
             continue;
         }
         
         if (input.empty()) continue;
         
+        // Подхватываем конфиг, пересобранный по SIGHUP
+        shared_ptr<const Config> fresh = current_config();
+        if (fresh->generation != config->generation) {
+            shared_ptr<const Config> previous = move(config);
+            config = fresh;
+            apply_config(*config, previous.get());
+        }
+        
+        // Фоновая загрузка истории к этому моменту почти всегда уже готова
+        if (history_job.valid()) {
+            HistoryState loaded = history_job.get();
+            loaded.entries.insert(loaded.entries.end(), history.begin(), history.end());
+            history = move(loaded.entries);
+            history_out = move(loaded.out);
+        }
+        
         // Сохранение в историю
         if (history_out.is_open()) {
             history_out << input << endl;
@@ -454,112 +858,50 @@ int main() {
         }
         history.push_back(input);
         
-        // Обработка специальных команд
-        if (input == "history") {
-            process_history(history_file);
+        // Блок if/while/for/функции может занимать несколько строк - копим до его конца
+        script_text += input;
+        ScriptResult result;
+        vfs_session_pump(true);
+        bool complete = script_run_text(script_text, result);
+        vfs_session_pump(false);
+        if (!complete) {
+            script_text += '\n';
+            continue;
         }
-        else if (input == "\\q") {
+        script_text.clear();
+        cout.flush();
+        
+        if (result.exited) {
+            exit_status = result.status;
             break;
         }
-        else if (input.substr(0, 3) == "\\l ") {
-            process_disk_info(input.substr(3));
-        }
-        else if (input.substr(0, 7) == "debug '" && input[input.length() - 1] == '\'') {
-            process_debug(input);
-        }
-        else if (input.substr(0,4) == "\\e $") {
-            process_env_var(input.substr(4));
-        }
-        else if (input.substr(0, 5) == "echo ") {
-            process_echo(input);
-        }
-        else {
-            // Разбиваем ввод на аргументы
-            vector<string> args;
-            stringstream ss(input);
-            string token;
-            while (ss >> token) {
-                args.push_back(token);
-            }
-            
-            if (args.empty()) continue;
-            
-            // Обработка команд управления файлами
-            if (args[0] == "cat" && args.size() > 1 && args[1] == "/etc/passwd") {
-                ifstream file("/etc/passwd");
-                if (file) {
-                    string line;
-                    while (getline(file, line)) {
-                        cout << line << endl;
-                    }
-                    file.close();
-                } else {
-                    cout << "cat: /etc/passwd: No such file or directory" << endl;
-                }
-            }
-            else if (args[0] == "mkdir" && args.size() > 1) {
-                string dir_path = args[1];
-                if (dir_path.find("/opt/users/") == 0) {
-                    string username = dir_path.substr(strlen("/opt/users/"));
-                    if (!username.empty() && username.find('/') == string::npos) {
-                        create_user_vfs_info(username);
-                        cout << "Created VFS directory for user: " << username << endl;
-                    } else {
-                        create_directory(dir_path);
-                    }
-                } else {
-                    create_directory(dir_path);
-                }
-            }
-            else if (args[0] == "ls" && args.size() > 1 && args[1] == "/opt/users") {
-                if (dir_exists("/opt/users")) {
-                    DIR* dir = opendir("/opt/users");
-                    if (dir) {
-                        struct dirent* entry;
-                        while ((entry = readdir(dir)) != nullptr) {
-                            if (entry->d_name[0] != '.') {
-                                string full_path = string("/opt/users/") + entry->d_name;
-                                if (dir_exists(full_path)) {
-                                    cout << entry->d_name << endl;
-                                }
-                            }
-                        }
-                        closedir(dir);
-                    }
-                } else {
-                    cout << "ls: cannot access '/opt/users': No such file or directory" << endl;
-                }
-            }
-            else if (args[0] == "rmdir" && args.size() > 1) {
-                string dir_path = args[1];
-                if (dir_path.find("/opt/users/") == 0) {
-                    string username = dir_path.substr(strlen("/opt/users/"));
-                    if (!username.empty() && username.find('/') == string::npos) {
-                        handle_user_deletion(username);
-                        string cmd = "rm -rf \"" + dir_path + "\"";
-                        system(cmd.c_str());
-                        cout << "Removed VFS directory and user: " << username << endl;
-                    } else {
-                        rmdir(dir_path.c_str());
-                    }
-                } else {
-                    rmdir(dir_path.c_str());
-                }
-            }
-            else {
-                // Выполнение внешней команды
-                if (!execute_external(args)) {
-                    cout << args[0] << ": command not found" << endl;
-                }
-            }
-        }
-        
-        cout.flush();
+    }
+    
+    if (!script_text.empty()) {
+        cerr << "kubsh: syntax error: unexpected end of file" << endl;
+        exit_status = 2;
     }
     
     if (history_out.is_open()) {
         history_out.close();
     }
     
-    return 0;
+    // Синхронизация пользователей сама ходит в точку монтирования. В режиме цикла
+    // отвечать ей после выхода из основного цикла некому, кроме потока подкачки.
+    if (vfs_sync_thread.joinable()) {
+        vfs_sync_cancelled = true;
+        vfs_session_pump(true);
+        vfs_sync_thread.join();
+        vfs_session_pump(false);
+    }
+    
+    // Изменения shell/home, которые еще не ушли в passwd
+    vfs_sync();
+    
+    // Чистое размонтирование вместо надежды на auto_unmount
+    if (loop_active()) {
+        loop_shutdown();
+    }
+    
+    return exit_status;
 }
@@ -0,0 +1,392 @@
+#include "redirect.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Размер блока для O_DIRECT и размер буфера копирования
+static const size_t DIRECT_ALIGN = 4096;
+static const size_t COPY_CHUNK = 1 << 20;
+
+// ==================== Разбор командной строки ====================
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Читает слово-цель перенаправления начиная с pos, снимая кавычки
+static string read_target(const string& input, size_t& pos) {
+    while (pos < input.size() && is_space(input[pos])) pos++;
+
+    string word;
+    char quote = 0;
+    while (pos < input.size()) {
+        char c = input[pos];
+        if (quote) {
+            if (c == quote) quote = 0;
+            else word += c;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (is_space(c) || c == '<' || c == '>') {
+            break;
+        } else {
+            word += c;
+        }
+        pos++;
+    }
+    return word;
+}
+
+bool split_redirections(const string& input, string& command,
+                        vector<Redirection>& redirs, string& error) {
+    command.clear();
+    redirs.clear();
+
+    char quote = 0;
+    size_t i = 0;
+    while (i < input.size()) {
+        char c = input[i];
+
+        if (quote) {
+            if (c == quote) quote = 0;
+            command += c;
+            i++;
+            continue;
+        }
+        if (c == '\'' || c == '"') {
+            quote = c;
+            command += c;
+            i++;
+            continue;
+        }
+
+        // Номер дескриптора перед оператором: 2>, 2>>, 2>&1, 0<
+        bool at_word_start = (i == 0 || is_space(input[i - 1]));
+        bool has_fd = at_word_start && c >= '0' && c <= '2' &&
+                      i + 1 < input.size() && (input[i + 1] == '>' || input[i + 1] == '<');
+
+        if (!has_fd && c != '>' && c != '<') {
+            command += c;
+            i++;
+            continue;
+        }
+
+        Redirection r;
+        size_t pos = i;
+        if (has_fd) {
+            r.fd = c - '0';
+            pos++;
+        } else {
+            r.fd = (c == '<') ? 0 : 1;
+        }
+
+        if (input[pos] == '<') {
+            r.flags = O_RDONLY;
+            pos++;
+        } else if (input.compare(pos, 2, ">>") == 0) {
+            r.flags = O_WRONLY | O_CREAT | O_APPEND;
+            pos += 2;
+        } else if (input.compare(pos, 2, ">&") == 0) {
+            pos += 2;
+            if (pos >= input.size() || input[pos] < '0' || input[pos] > '2') {
+                error = "syntax error near `>&'";
+                return false;
+            }
+            r.dup_from = input[pos] - '0';
+            pos++;
+            redirs.push_back(r);
+            command += ' ';
+            i = pos;
+            continue;
+        } else if (input.compare(pos, 8, ">|direct") == 0 &&
+                   (pos + 8 == input.size() || is_space(input[pos + 8]))) {
+            r.flags = O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT;
+            r.direct = true;
+            pos += 8;
+        } else if (input.compare(pos, 2, ">|") == 0) {
+            r.flags = O_WRONLY | O_CREAT | O_TRUNC;
+            pos += 2;
+        } else {
+            r.flags = O_WRONLY | O_CREAT | O_TRUNC;
+            pos++;
+        }
+
+        r.path = read_target(input, pos);
+        if (r.path.empty()) {
+            error = "syntax error near unexpected token `newline'";
+            return false;
+        }
+
+        redirs.push_back(r);
+        command += ' ';
+        i = pos;
+    }
+
+    if (quote) {
+        error = "unexpected EOF while looking for matching quote";
+        return false;
+    }
+
+    command.erase(0, command.find_first_not_of(" \t"));
+    size_t last = command.find_last_not_of(" \t");
+    command.erase(last == string::npos ? 0 : last + 1);
+    return true;
+}
+
+// ==================== Открытие дескрипторов ====================
+
+bool open_redirections(const vector<Redirection>& redirs, IoTarget& io) {
+    int fds[3] = {io.in, io.out, io.err};
+
+    for (const auto& r : redirs) {
+        if (r.dup_from >= 0) {
+            fds[r.fd] = fds[r.dup_from];
+            if (r.fd == 1) io.direct = false;
+            continue;
+        }
+
+        int fd = open(r.path.c_str(), r.flags | O_CLOEXEC, 0644);
+        bool direct = r.direct;
+        if (fd < 0 && direct && errno == EINVAL) {
+            // Файловая система не поддерживает O_DIRECT (tmpfs и т.п.) - обычная запись
+            fd = open(r.path.c_str(), (r.flags & ~O_DIRECT) | O_CLOEXEC, 0644);
+            direct = false;
+        }
+        if (fd < 0) {
+            string msg = "kubsh: " + r.path + ": " + strerror(errno) + "\n";
+            write_all(STDERR_FILENO, msg.data(), msg.size());
+            close_redirections(io);
+            return false;
+        }
+
+        io.opened.push_back(fd);
+        fds[r.fd] = fd;
+        if (r.fd == 1) io.direct = direct;
+    }
+
+    io.in = fds[0];
+    io.out = fds[1];
+    io.err = fds[2];
+    return true;
+}
+
+void close_redirections(IoTarget& io) {
+    for (int fd : io.opened) {
+        close(fd);
+    }
+    io.opened.clear();
+}
+
+void install_redirections(const IoTarget& io, int saved[3]) {
+    // io уже посчитан в порядке записи ("2>&1 > f": err - старый stdout).
+    // Источники копируются заранее, иначе dup2 на 1 испортит источник для 2.
+    int fds[3] = {io.in, io.out, io.err};
+    int sources[3] = {-1, -1, -1};
+    for (int fd = 0; fd < 3; fd++) {
+        if (saved) saved[fd] = -1;
+        if (fds[fd] != fd) sources[fd] = fcntl(fds[fd], F_DUPFD_CLOEXEC, 10);
+    }
+
+    for (int fd = 0; fd < 3; fd++) {
+        if (sources[fd] < 0) continue;
+        if (saved) saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+        dup2(sources[fd], fd);
+        close(sources[fd]);
+    }
+}
+
+void apply_redirections_in_child(const IoTarget& io) {
+    install_redirections(io, nullptr);
+
+    // Внешние команды пишут невыровненными кусками - O_DIRECT им не подходит
+    if (io.direct) {
+        int flags = fcntl(STDOUT_FILENO, F_GETFL);
+        if (flags >= 0) fcntl(STDOUT_FILENO, F_SETFL, flags & ~O_DIRECT);
+    }
+}
+
+// ==================== Запись ====================
+
+bool write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void drop_direct(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0 && (flags & O_DIRECT)) {
+        fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+    }
+}
+
+static bool has_direct(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && (flags & O_DIRECT);
+}
+
+// Пишет выровненную часть буфера с O_DIRECT. Возвращает сколько записано.
+// Если ядро отказалось (смещение не выровнено и т.п.) - снимает O_DIRECT.
+static size_t write_aligned(int fd, const char* buf, size_t len) {
+    size_t aligned = len - len % DIRECT_ALIGN;
+    size_t done = 0;
+    while (done < aligned) {
+        ssize_t n = write(fd, buf + done, aligned - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            drop_direct(fd);
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static void* alloc_aligned(size_t size) {
+    void* p = nullptr;
+    if (posix_memalign(&p, DIRECT_ALIGN, size) != 0) return nullptr;
+    return p;
+}
+
+// Запись большого вывода мимо page cache: полные блоки через O_DIRECT,
+// хвост - обычной записью
+static bool write_direct(int fd, const char* data, size_t len) {
+    if (!has_direct(fd)) return write_all(fd, data, len);
+
+    char* buf = static_cast<char*>(alloc_aligned(COPY_CHUNK));
+    if (!buf) {
+        drop_direct(fd);
+        return write_all(fd, data, len);
+    }
+
+    while (len >= DIRECT_ALIGN && has_direct(fd)) {
+        size_t chunk = min(len, COPY_CHUNK);
+        chunk -= chunk % DIRECT_ALIGN;
+        memcpy(buf, data, chunk);
+        size_t done = write_aligned(fd, buf, chunk);
+        data += done;
+        len -= done;
+        if (done < chunk) break;
+    }
+    free(buf);
+
+    drop_direct(fd);
+    return write_all(fd, data, len);
+}
+
+void emit(const IoTarget& io, const string& data) {
+    if (io.direct) {
+        write_direct(io.out, data.data(), data.size());
+    } else {
+        write_all(io.out, data.data(), data.size());
+    }
+}
+
+void emit_err(const IoTarget& io, const string& data) {
+    write_all(io.err, data.data(), data.size());
+}
+
+// ==================== Копирование файла ====================
+
+static bool copy_read_write(int in, int out) {
+    char buf[65536];
+    while (true) {
+        ssize_t n = read(in, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) return true;
+        if (!write_all(out, buf, n)) return false;
+    }
+}
+
+// Копирование без прохода через user space: splice в пайп, sendfile в остальное.
+// Если ядро не умеет для данной пары дескрипторов - обычный read/write.
+static bool copy_zero_copy(int in, int out, bool out_is_pipe) {
+    bool first = true;
+    while (true) {
+        ssize_t n = out_is_pipe
+            ? splice(in, nullptr, out, nullptr, COPY_CHUNK, SPLICE_F_MOVE)
+            : sendfile(out, in, nullptr, COPY_CHUNK);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (first && (errno == EINVAL || errno == ENOSYS)) {
+                return copy_read_write(in, out);
+            }
+            return false;
+        }
+        if (n == 0) return true;
+        first = false;
+    }
+}
+
+static bool copy_direct(int in, int out) {
+    char* buf = static_cast<char*>(alloc_aligned(COPY_CHUNK));
+    if (!buf) {
+        drop_direct(out);
+        return copy_read_write(in, out);
+    }
+
+    size_t filled = 0;
+    bool ok = true;
+    while (true) {
+        ssize_t n = read(in, buf + filled, COPY_CHUNK - filled);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+        filled += n;
+        if (n == 0 || !has_direct(out)) break;
+        if (filled < COPY_CHUNK) continue;
+
+        size_t done = write_aligned(out, buf, filled);
+        memmove(buf, buf + done, filled - done);
+        filled -= done;
+    }
+
+    if (ok && has_direct(out)) {
+        size_t done = write_aligned(out, buf, filled);
+        memmove(buf, buf + done, filled - done);
+        filled -= done;
+    }
+
+    // Хвост меньше блока (или все после отказа O_DIRECT) - обычной записью
+    if (ok) {
+        drop_direct(out);
+        ok = write_all(out, buf, filled) && copy_read_write(in, out);
+    }
+    free(buf);
+    return ok;
+}
+
+bool emit_file(const IoTarget& io, const string& path) {
+    int in = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+
+    bool ok;
+    if (io.direct && has_direct(io.out)) {
+        ok = copy_direct(in, io.out);
+    } else {
+        struct stat st;
+        bool out_is_pipe = fstat(io.out, &st) == 0 && S_ISFIFO(st.st_mode);
+        ok = copy_zero_copy(in, io.out, out_is_pipe);
+    }
+
+    close(in);
+    return ok;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// ==================== Перенаправления ввода/вывода ====================
+
+// Одно перенаправление из командной строки: "> f", ">> f", "< f", "2> f", "2>&1", ">|direct f"
+struct Redirection {
+    int fd = 1;               // Какой дескриптор перенаправляем (0, 1, 2)
+    int dup_from = -1;        // Для N>&M - номер M, иначе -1
+    std::string path;         // Файл назначения
+    int flags = 0;            // Флаги для open
+    bool direct = false;      // >|direct - запись выровненными блоками через O_DIRECT
+};
+
+// Куда пишут/откуда читают встроенные и внешние команды
+struct IoTarget {
+    int in = 0;
+    int out = 1;
+    int err = 2;
+    bool direct = false;      // out открыт с O_DIRECT
+    std::vector<int> opened;  // Дескрипторы, которые нужно закрыть после команды
+};
+
+// Вырезает операторы перенаправления из строки (кавычки учитываются).
+// В command остается сама команда без перенаправлений.
+// При синтаксической ошибке возвращает false и описание в error.
+bool split_redirections(const std::string& input, std::string& command,
+                        std::vector<Redirection>& redirs, std::string& error);
+
+// Открывает файлы перенаправлений по порядку. Ошибку пишет в stderr.
+bool open_redirections(const std::vector<Redirection>& redirs, IoTarget& io);
+void close_redirections(IoTarget& io);
+
+// Ставит io.in/out/err на 0/1/2 текущего процесса. В saved (если не nullptr) -
+// копии прежних дескрипторов для восстановления, -1 - дескриптор не менялся.
+void install_redirections(const IoTarget& io, int saved[3]);
+
+// Вызывается в дочернем процессе перед exec
+void apply_redirections_in_child(const IoTarget& io);
+
+// Вывод встроенных команд прямо в дескриптор, минуя cout
+bool write_all(int fd, const char* data, size_t len);
+void emit(const IoTarget& io, const std::string& data);
+void emit_err(const IoTarget& io, const std::string& data);
+
+// Копирует файл в out: splice/sendfile без копирования в user space,
+// для >|direct - выровненными O_DIRECT блоками
+bool emit_file(const IoTarget& io, const std::string& path);
@@ -0,0 +1,1174 @@
+#include "script.hpp"
+#include "glob.hpp"
+#include "redirect.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+using namespace std;
+
+// Вложенность вызовов функций и source
+static const int MAX_CALL_DEPTH = 200;
+
+static CommandRunner command_runner = nullptr;
+static const volatile sig_atomic_t* running_flag = nullptr;
+
+// $?
+static int last_status = 0;
+
+// ==================== Байткод ====================
+
+enum OpCode : uint8_t {
+    OP_RUN,          // a - текст команды, b - 1, если в нем есть $ для подстановки
+    OP_ASSIGN,       // a - имя переменной, b - значение
+    OP_EXPORT,       // a - имя, b - значение (пустая строка - текущее)
+    OP_TEST,         // a - аргументы [ ... ] / test
+    OP_STATUS,       // $? = a (true, false, :)
+    OP_NOT,          // ! cmd
+    OP_JUMP,         // a - адрес
+    OP_JUMP_FAIL,    // на a, если $? != 0
+    OP_JUMP_OK,      // на a, если $? == 0
+    OP_FOR_INIT,     // a - список слов: подставить, разбить, раскрыть шаблоны
+    OP_FOR_NEXT,     // a - имя переменной, b - адрес выхода, когда слова кончились
+    OP_FOR_POP,      // снять итератор for
+    OP_DEFUN,        // a - имя функции, b - адрес тела
+    OP_REDIR_PUSH,   // a - перенаправления блока ("done > log"), b - куда идти, если не открылись
+    OP_REDIR_POP,
+    OP_RETURN,       // a - код (пустая строка - $?)
+    OP_EXIT,         // a - код (пустая строка - $?)
+    OP_HALT,
+};
+
+struct Instr {
+    OpCode op;
+    uint32_t a;
+    uint32_t b;
+};
+
+// Скомпилированный текст: инструкции и строки лежат в одном блоке памяти,
+// который выделяется и освобождается целиком
+struct Program {
+    unique_ptr<char[]> arena;
+    const Instr* code = nullptr;
+    const char* strings = nullptr;
+
+    const char* str(uint32_t offset) const {
+        return strings + offset;
+    }
+};
+
+struct Builder {
+    vector<Instr> code;
+    string strings = string(1, '\0');  // Смещение 0 - пустая строка
+
+    uint32_t add_string(const string& s) {
+        if (s.empty()) return 0;
+        uint32_t offset = strings.size();
+        strings += s;
+        strings += '\0';
+        return offset;
+    }
+
+    uint32_t emit(OpCode op, uint32_t a = 0, uint32_t b = 0) {
+        code.push_back({op, a, b});
+        return code.size() - 1;
+    }
+
+    uint32_t here() const {
+        return code.size();
+    }
+
+    shared_ptr<const Program> finish() {
+        emit(OP_HALT);
+
+        auto prog = make_shared<Program>();
+        size_t code_bytes = code.size() * sizeof(Instr);
+        prog->arena.reset(new char[code_bytes + strings.size()]);
+        memcpy(prog->arena.get(), code.data(), code_bytes);
+        memcpy(prog->arena.get() + code_bytes, strings.data(), strings.size());
+        prog->code = reinterpret_cast<const Instr*>(prog->arena.get());
+        prog->strings = prog->arena.get() + code_bytes;
+        return prog;
+    }
+};
+
+// ==================== Разбор текста ====================
+
+// Текст режется на простые команды (как есть, с кавычками и перенаправлениями -
+// их разбирает уже исполнитель строки), ключевые слова и разделители
+enum UnitKind {
+    U_CMD,           // text - команда
+    U_WORD,          // text - ключевое слово
+    U_FOR,           // text - переменная, extra - список слов
+    U_FUNC,          // text - имя функции
+    U_AND,
+    U_OR,
+    U_SEP,           // text - ";" или "\n"
+    U_END,
+};
+
+struct Unit {
+    UnitKind kind;
+    string text;
+    string extra;
+};
+
+static const char* const KEYWORDS[] = {
+    "if", "then", "elif", "else", "fi", "while", "until", "do", "done", "{", "}", "!",
+};
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static bool is_keyword(const string& word) {
+    for (const char* kw : KEYWORDS) {
+        if (word == kw) return true;
+    }
+    return false;
+}
+
+static bool is_name(const string& s) {
+    if (s.empty() || !(isalpha((unsigned char) s[0]) || s[0] == '_')) return false;
+    for (char c : s) {
+        if (!(isalnum((unsigned char) c) || c == '_')) return false;
+    }
+    return true;
+}
+
+static string trim(const string& s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == string::npos) return "";
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(start, end - start + 1);
+}
+
+// NAME=value одним словом (значение может быть в кавычках с пробелами)
+static bool is_assignment(const string& text) {
+    size_t eq = text.find('=');
+    if (eq == string::npos || !is_name(text.substr(0, eq))) return false;
+
+    char quote = 0;
+    for (size_t i = eq + 1; i < text.size(); i++) {
+        char c = text[i];
+        if (quote) {
+            if (c == quote) quote = 0;
+        } else if (c == '\\') {
+            i++;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (is_blank(c)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool starts_with_redirection(const string& text) {
+    size_t i = (text[0] >= '0' && text[0] <= '2') ? 1 : 0;
+    return i < text.size() && (text[i] == '>' || text[i] == '<');
+}
+
+// Конец простой команды: ; перевод строки && || или комментарий (вне кавычек)
+static size_t command_end(const string& src, size_t pos) {
+    char quote = 0;
+    for (size_t i = pos; i < src.size(); i++) {
+        char c = src[i];
+        if (quote) {
+            if (c == quote) quote = 0;
+            else if (c == '\\' && quote == '"') i++;
+            continue;
+        }
+        if (c == '\\') {
+            i++;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '\n' || c == ';') {
+            return i;
+        } else if ((c == '&' || c == '|') && i + 1 < src.size() && src[i + 1] == c) {
+            return i;
+        } else if (c == '#' && i > pos && is_blank(src[i - 1])) {
+            return i;
+        }
+    }
+    return src.size();
+}
+
+static void lex(const string& src, vector<Unit>& units) {
+    size_t pos = 0;
+    while (true) {
+        while (pos < src.size() && is_blank(src[pos])) pos++;
+        if (pos >= src.size()) break;
+
+        char c = src[pos];
+        if (c == '#') {
+            while (pos < src.size() && src[pos] != '\n') pos++;
+            continue;
+        }
+        if (c == '\\' && pos + 1 < src.size() && src[pos + 1] == '\n') {
+            pos += 2;
+            continue;
+        }
+        if (c == '\n' || c == ';') {
+            units.push_back({U_SEP, string(1, c), ""});
+            pos++;
+            continue;
+        }
+        if (src.compare(pos, 2, "&&") == 0 || src.compare(pos, 2, "||") == 0) {
+            units.push_back({c == '&' ? U_AND : U_OR, "", ""});
+            pos += 2;
+            continue;
+        }
+
+        // Первое слово команды решает, ключевое ли это слово
+        size_t end = pos;
+        while (end < src.size() && !is_blank(src[end]) && !strchr(";\n()", src[end])) end++;
+        string word = src.substr(pos, end - pos);
+
+        if (is_keyword(word)) {
+            units.push_back({U_WORD, word, ""});
+            pos = end;
+            continue;
+        }
+
+        if (word == "for") {
+            size_t header_end = command_end(src, end);
+            string header = trim(src.substr(end, header_end - end));
+            size_t blank = header.find_first_of(" \t");
+            string name = header.substr(0, blank);
+            string rest = blank == string::npos ? "" : trim(header.substr(blank));
+
+            // for name; do - по аргументам сценария
+            string words = "\"$@\"";
+            if (rest.compare(0, 2, "in") == 0 && (rest.size() == 2 || is_blank(rest[2]))) {
+                words = trim(rest.substr(2));
+            }
+            units.push_back({U_FOR, name, words});
+            pos = header_end;
+            continue;
+        }
+
+        if (word == "function") {
+            size_t name_start = end;
+            while (name_start < src.size() && is_blank(src[name_start])) name_start++;
+            size_t name_end = name_start;
+            while (name_end < src.size() && !is_blank(src[name_end]) && !strchr(";\n({", src[name_end])) name_end++;
+            units.push_back({U_FUNC, src.substr(name_start, name_end - name_start), ""});
+            pos = name_end;
+            while (pos < src.size() && is_blank(src[pos])) pos++;
+            if (src.compare(pos, 2, "()") == 0) pos += 2;
+            continue;
+        }
+
+        // name() { ... }
+        size_t after = end;
+        while (after < src.size() && is_blank(src[after])) after++;
+        if (is_name(word) && src.compare(after, 2, "()") == 0) {
+            units.push_back({U_FUNC, word, ""});
+            pos = after + 2;
+            continue;
+        }
+
+        size_t cmd_end = command_end(src, pos);
+        if (cmd_end == pos) cmd_end = pos + 1;
+        units.push_back({U_CMD, trim(src.substr(pos, cmd_end - pos)), ""});
+        pos = cmd_end;
+    }
+    units.push_back({U_END, "", ""});
+}
+
+// ==================== Компиляция ====================
+
+struct LoopContext {
+    bool is_for;
+    uint32_t continue_addr;
+    vector<uint32_t> breaks;
+    size_t redirs;             // Открытых перенаправлений блоков на входе в тело цикла
+};
+
+struct Compiler {
+    const vector<Unit>& units;
+    size_t pos = 0;
+    Builder b;
+    vector<LoopContext> loops;
+    size_t redirs = 0;         // Сколько OP_REDIR_PUSH сейчас открыто вокруг компилируемого кода
+    string error;
+    bool incomplete = false;
+
+    explicit Compiler(const vector<Unit>& u) : units(u) {}
+
+    const Unit& peek() const {
+        return units[pos];
+    }
+
+    bool at_word(const char* kw) const {
+        return peek().kind == U_WORD && peek().text == kw;
+    }
+
+    void skip_separators() {
+        while (peek().kind == U_SEP) pos++;
+    }
+
+    bool fail(const Unit& u) {
+        // Текст кончился посреди блока - как и в интерактивном режиме при EOF
+        if (u.kind == U_END) {
+            incomplete = true;
+            error = "syntax error: unexpected end of file";
+            return false;
+        }
+
+        string token;
+        switch (u.kind) {
+        case U_AND: token = "&&"; break;
+        case U_OR: token = "||"; break;
+        case U_SEP: token = u.text == ";" ? ";" : "newline"; break;
+        case U_FOR: token = "for"; break;
+        case U_FUNC: token = u.text; break;
+        default: token = u.text; break;
+        }
+        error = "syntax error near unexpected token `" + token + "'";
+        return false;
+    }
+
+    bool expect(const char* kw) {
+        skip_separators();
+        if (!at_word(kw)) return fail(peek());
+        pos++;
+        return true;
+    }
+
+    // Команды до одного из завершающих слов (then, fi, done, ...) или до конца текста
+    bool parse_list(initializer_list<const char*> terminators) {
+        while (true) {
+            skip_separators();
+            const Unit& u = peek();
+            if (u.kind == U_END) {
+                return terminators.size() == 0 ? true : fail(u);
+            }
+            if (u.kind == U_WORD) {
+                for (const char* t : terminators) {
+                    if (u.text == t) return true;
+                }
+            }
+            if (!parse_and_or()) return false;
+        }
+    }
+
+    // a && b || c: после каждой команды переход через следующую по $?
+    bool parse_and_or() {
+        if (!parse_pipeline()) return false;
+
+        while (peek().kind == U_AND || peek().kind == U_OR) {
+            OpCode jump = peek().kind == U_AND ? OP_JUMP_FAIL : OP_JUMP_OK;
+            pos++;
+            while (peek().kind == U_SEP && peek().text == "\n") pos++;
+
+            uint32_t at = b.emit(jump);
+            if (!parse_pipeline()) return false;
+            b.code[at].a = b.here();
+        }
+        return true;
+    }
+
+    bool parse_pipeline() {
+        bool negate = at_word("!");
+        if (negate) pos++;
+        if (!parse_command()) return false;
+        if (negate) b.emit(OP_NOT);
+        return true;
+    }
+
+    // Перенаправление всего блока пишется после закрывающего слова: "done > log", "} 2>&1"
+    bool block_redirect(string& text) const {
+        int depth = 0;
+        for (size_t i = pos; units[i].kind != U_END; i++) {
+            const Unit& u = units[i];
+            if (u.kind == U_FOR) {
+                depth++;
+            } else if (u.kind == U_WORD) {
+                if (u.text == "if" || u.text == "while" || u.text == "until" || u.text == "{") {
+                    depth++;
+                } else if ((u.text == "fi" || u.text == "done" || u.text == "}") && --depth == 0) {
+                    const Unit& next = units[i + 1];
+                    if (next.kind != U_CMD || !starts_with_redirection(next.text)) return false;
+                    text = next.text;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool parse_command() {
+        const Unit& u = peek();
+        if (u.kind == U_FOR || u.kind == U_WORD) {
+            string redirect;
+            if (block_redirect(redirect)) {
+                uint32_t push = b.emit(OP_REDIR_PUSH, b.add_string(redirect));
+                redirs++;
+                if (!parse_compound()) return false;
+                redirs--;
+                pos++;
+                b.emit(OP_REDIR_POP);
+                b.code[push].b = b.here();
+                return true;
+            }
+        }
+        return parse_compound();
+    }
+
+    bool parse_compound() {
+        const Unit& u = peek();
+        switch (u.kind) {
+        case U_CMD:
+            pos++;
+            return compile_simple(u.text);
+        case U_FOR:
+            pos++;
+            return parse_for(u);
+        case U_FUNC:
+            pos++;
+            return parse_function(u);
+        case U_WORD:
+            if (u.text == "if") {
+                pos++;
+                return parse_if();
+            }
+            if (u.text == "while" || u.text == "until") {
+                pos++;
+                return parse_while(u.text == "until");
+            }
+            if (u.text == "{") {
+                pos++;
+                return parse_list({"}"}) && expect("}");
+            }
+            return fail(u);
+        default:
+            return fail(u);
+        }
+    }
+
+    bool parse_if() {
+        vector<uint32_t> ends;
+        while (true) {
+            if (!parse_list({"then"}) || !expect("then")) return false;
+            uint32_t skip = b.emit(OP_JUMP_FAIL);
+            if (!parse_list({"elif", "else", "fi"})) return false;
+            ends.push_back(b.emit(OP_JUMP));
+            b.code[skip].a = b.here();
+
+            if (!at_word("elif")) break;
+            pos++;
+        }
+
+        if (at_word("else")) {
+            pos++;
+            if (!parse_list({"fi"})) return false;
+        } else {
+            // Ни одна ветка не сработала - if завершается с кодом 0
+            b.emit(OP_STATUS, 0);
+        }
+        if (!expect("fi")) return false;
+
+        for (uint32_t at : ends) b.code[at].a = b.here();
+        return true;
+    }
+
+    bool parse_while(bool until) {
+        uint32_t top = b.here();
+        if (!parse_list({"do"}) || !expect("do")) return false;
+        uint32_t exit_jump = b.emit(until ? OP_JUMP_OK : OP_JUMP_FAIL);
+
+        loops.push_back({false, top, {}, redirs});
+        if (!parse_list({"done"}) || !expect("done")) return false;
+        b.emit(OP_JUMP, top);
+
+        uint32_t done = b.emit(OP_STATUS, 0);
+        b.code[exit_jump].a = done;
+        for (uint32_t at : loops.back().breaks) b.code[at].a = done;
+        loops.pop_back();
+        return true;
+    }
+
+    bool parse_for(const Unit& header) {
+        if (!is_name(header.text)) {
+            error = "`" + header.text + "': not a valid identifier";
+            return false;
+        }
+
+        b.emit(OP_FOR_INIT, b.add_string(header.extra));
+        if (!expect("do")) return false;
+        uint32_t top = b.emit(OP_FOR_NEXT, b.add_string(header.text));
+
+        loops.push_back({true, top, {}, redirs});
+        if (!parse_list({"done"}) || !expect("done")) return false;
+        b.emit(OP_JUMP, top);
+
+        uint32_t done = b.emit(OP_FOR_POP);
+        b.code[top].b = done;
+        for (uint32_t at : loops.back().breaks) b.code[at].a = done;
+        loops.pop_back();
+        return true;
+    }
+
+    // Определение - это инструкция: имя связывается с телом, когда до него дошло выполнение
+    bool parse_function(const Unit& header) {
+        if (!is_name(header.text)) {
+            error = "`" + header.text + "': not a valid identifier";
+            return false;
+        }
+
+        uint32_t def = b.emit(OP_DEFUN, b.add_string(header.text));
+        uint32_t skip = b.emit(OP_JUMP);
+        b.code[def].b = b.here();
+
+        // break/continue из тела не выходят за пределы функции
+        vector<LoopContext> outer;
+        outer.swap(loops);
+        skip_separators();
+        if (!parse_command()) return false;
+        loops.swap(outer);
+
+        b.emit(OP_RETURN, 0);
+        b.code[skip].a = b.here();
+        return true;
+    }
+
+    // break n / continue n: итераторы вложенных for и перенаправления блоков
+    // ({ ...; } > f внутри цикла), из которых выходим, снимаются до перехода
+    bool compile_loop_jump(bool is_break, const string& arg) {
+        if (loops.empty()) {
+            b.emit(OP_STATUS, 0);
+            return true;
+        }
+
+        size_t n = arg.empty() ? 1 : strtoul(arg.c_str(), nullptr, 10);
+        if (n < 1) n = 1;
+        if (n > loops.size()) n = loops.size();
+
+        for (size_t k = 0; k + 1 < n; k++) {
+            if (loops[loops.size() - 1 - k].is_for) b.emit(OP_FOR_POP);
+        }
+
+        LoopContext& target = loops[loops.size() - n];
+        for (size_t k = target.redirs; k < redirs; k++) b.emit(OP_REDIR_POP);
+        if (is_break) {
+            target.breaks.push_back(b.emit(OP_JUMP));
+        } else {
+            b.emit(OP_JUMP, target.continue_addr);
+        }
+        return true;
+    }
+
+    bool compile_simple(const string& text) {
+        size_t blank = text.find_first_of(" \t");
+        string first = text.substr(0, blank);
+        string rest = blank == string::npos ? "" : trim(text.substr(blank));
+
+        if (text == "true" || text == ":") {
+            b.emit(OP_STATUS, 0);
+        } else if (text == "false") {
+            b.emit(OP_STATUS, 1);
+        } else if (first == "exit" || text == "\\q") {
+            b.emit(OP_EXIT, b.add_string(first == "exit" ? rest : ""));
+        } else if (first == "return") {
+            b.emit(OP_RETURN, b.add_string(rest));
+        } else if (first == "break" || first == "continue") {
+            return compile_loop_jump(first == "break", rest);
+        } else if (first == "[" || first == "test") {
+            b.emit(OP_TEST, b.add_string(text));
+        } else if (first == "export" && is_assignment(rest)) {
+            size_t eq = rest.find('=');
+            b.emit(OP_EXPORT, b.add_string(rest.substr(0, eq)), b.add_string(rest.substr(eq + 1)));
+        } else if (first == "export" && is_name(rest)) {
+            b.emit(OP_EXPORT, b.add_string(rest));
+        } else if (is_assignment(text)) {
+            size_t eq = text.find('=');
+            b.emit(OP_ASSIGN, b.add_string(text.substr(0, eq)), b.add_string(text.substr(eq + 1)));
+        } else {
+            // \e $VAR сам читает переменную по имени - подстановка ему не нужна
+            bool expand = text.find('$') != string::npos && text.compare(0, 3, "\\e ") != 0;
+            b.emit(OP_RUN, b.add_string(text), expand ? 1 : 0);
+        }
+        return true;
+    }
+};
+
+enum CompileResult { COMPILE_OK, COMPILE_INCOMPLETE, COMPILE_ERROR };
+
+static CompileResult compile(const string& src, shared_ptr<const Program>& prog, string& error) {
+    vector<Unit> units;
+    lex(src, units);
+
+    Compiler c(units);
+    if (!c.parse_list({})) {
+        error = c.error;
+        return c.incomplete ? COMPILE_INCOMPLETE : COMPILE_ERROR;
+    }
+    prog = c.b.finish();
+    return COMPILE_OK;
+}
+
+// ==================== Кэш сценариев ====================
+
+// Повторный source того же файла (например, в цикле) берет готовый байткод
+struct CachedScript {
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    shared_ptr<const Program> program;
+};
+
+static unordered_map<string, CachedScript> script_cache;
+
+static shared_ptr<const Program> load_script(const string& path, string& error) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        error = strerror(errno);
+        return nullptr;
+    }
+
+    auto it = script_cache.find(path);
+    if (it != script_cache.end() && it->second.mtime_sec == st.st_mtim.tv_sec &&
+        it->second.mtime_nsec == st.st_mtim.tv_nsec && it->second.size == st.st_size) {
+        return it->second.program;
+    }
+
+    ifstream in(path, ios::binary);
+    if (!in) {
+        error = strerror(errno);
+        return nullptr;
+    }
+    string src((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+    shared_ptr<const Program> prog;
+    if (compile(src, prog, error) != COMPILE_OK) return nullptr;
+
+    script_cache[path] = {st.st_mtim.tv_sec, st.st_mtim.tv_nsec, st.st_size, prog};
+    return prog;
+}
+
+// ==================== Подстановки ====================
+
+struct ForState {
+    vector<string> items;
+    size_t next = 0;
+};
+
+// Копии stdin/stdout/stderr шелла на время перенаправленного блока (-1 - не менялся)
+struct SavedFds {
+    int fd[3] = {-1, -1, -1};
+};
+
+struct Frame {
+    string name;               // $0
+    vector<string> args;       // $1, $2, ...
+    vector<ForState> loops;
+    vector<SavedFds> redirs;
+};
+
+struct Function {
+    shared_ptr<const Program> program;
+    uint32_t entry;
+};
+
+static unordered_map<string, Function> functions;
+
+static string join_args(const Frame& frame) {
+    string out;
+    for (size_t i = 0; i < frame.args.size(); i++) {
+        if (i > 0) out += ' ';
+        out += frame.args[i];
+    }
+    return out;
+}
+
+// Переменные сценария живут здесь, в окружение (и к детям) попадают только
+// уже экспортированные и объявленные через export. setenv на каждую итерацию
+// цикла стоил бы дорого: glibc хранит все когда-либо установленные значения.
+static unordered_map<string, string> variables;
+
+static string var_value(const string& name) {
+    auto it = variables.find(name);
+    if (it != variables.end()) return it->second;
+    const char* value = getenv(name.c_str());
+    return value ? value : "";
+}
+
+static void set_var(const char* name, const string& value) {
+    if (getenv(name)) {
+        setenv(name, value.c_str(), 1);
+    } else {
+        variables[name] = value;
+    }
+}
+
+// $?, $#, $$, $@, $0..$9, $NAME, ${NAME} вне одинарных кавычек.
+// Кавычки остаются на месте - их снимает исполнитель строки.
+static string expand_vars(const string& text, const Frame& frame) {
+    string out;
+    char quote = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if ((c == '\'' || c == '"') && (quote == 0 || quote == c)) {
+            quote = quote ? 0 : c;
+            out += c;
+            continue;
+        }
+        if (c == '\\' && quote != '\'' && i + 1 < text.size() && text[i + 1] == '$') {
+            out += '$';
+            i++;
+            continue;
+        }
+        if (c != '$' || quote == '\'' || i + 1 >= text.size()) {
+            out += c;
+            continue;
+        }
+
+        char n = text[i + 1];
+        if (n == '?') {
+            out += to_string(last_status);
+            i++;
+        } else if (n == '#') {
+            out += to_string(frame.args.size());
+            i++;
+        } else if (n == '$') {
+            out += to_string(getpid());
+            i++;
+        } else if (n == '@' || n == '*') {
+            out += join_args(frame);
+            i++;
+        } else if (isdigit((unsigned char) n)) {
+            size_t index = n - '0';
+            if (index == 0) out += frame.name;
+            else if (index <= frame.args.size()) out += frame.args[index - 1];
+            i++;
+        } else if (n == '{') {
+            size_t close = text.find('}', i + 2);
+            if (close == string::npos) {
+                out += c;
+                continue;
+            }
+            out += var_value(text.substr(i + 2, close - i - 2));
+            i = close;
+        } else if (isalpha((unsigned char) n) || n == '_') {
+            size_t j = i + 1;
+            while (j < text.size() && (isalnum((unsigned char) text[j]) || text[j] == '_')) j++;
+            out += var_value(text.substr(i + 1, j - i - 1));
+            i = j - 1;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+struct Word {
+    string text;
+    bool quoted = false;
+};
+
+// Слова с учетом кавычек; split = false - все одним словом (значение присваивания)
+static vector<Word> split_words(const string& text, bool split = true) {
+    vector<Word> words;
+    Word word;
+    bool in_word = false;
+    char quote = 0;
+
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (quote) {
+            if (c == quote) quote = 0;
+            else if (c == '\\' && quote == '"' && i + 1 < text.size() && strchr("\"\\$", text[i + 1])) word.text += text[++i];
+            else word.text += c;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            word.quoted = true;
+            in_word = true;
+        } else if (c == '\\' && i + 1 < text.size()) {
+            word.text += text[++i];
+            in_word = true;
+        } else if (split && is_blank(c)) {
+            if (in_word) words.push_back(word);
+            word = Word();
+            in_word = false;
+        } else {
+            word.text += c;
+            in_word = true;
+        }
+    }
+    if (in_word) words.push_back(word);
+    return words;
+}
+
+static int parse_status(const char* text, const Frame& frame) {
+    string value = trim(expand_vars(text, frame));
+    if (value.empty()) return last_status;
+    return atoi(value.c_str()) & 0xff;
+}
+
+// ==================== test / [ ====================
+
+static int test_unary(const string& op, const string& arg) {
+    struct stat st;
+    if (op == "-n") return arg.empty() ? 1 : 0;
+    if (op == "-z") return arg.empty() ? 0 : 1;
+    if (op == "-e") return stat(arg.c_str(), &st) == 0 ? 0 : 1;
+    if (op == "-f") return stat(arg.c_str(), &st) == 0 && S_ISREG(st.st_mode) ? 0 : 1;
+    if (op == "-d") return stat(arg.c_str(), &st) == 0 && S_ISDIR(st.st_mode) ? 0 : 1;
+    if (op == "-s") return stat(arg.c_str(), &st) == 0 && st.st_size > 0 ? 0 : 1;
+    if (op == "-L" || op == "-h") return lstat(arg.c_str(), &st) == 0 && S_ISLNK(st.st_mode) ? 0 : 1;
+    if (op == "-r") return access(arg.c_str(), R_OK) == 0 ? 0 : 1;
+    if (op == "-w") return access(arg.c_str(), W_OK) == 0 ? 0 : 1;
+    if (op == "-x") return access(arg.c_str(), X_OK) == 0 ? 0 : 1;
+
+    cerr << "kubsh: test: " << op << ": unary operator expected" << endl;
+    return 2;
+}
+
+static bool parse_integer(const string& s, long long& value) {
+    char* end = nullptr;
+    errno = 0;
+    value = strtoll(s.c_str(), &end, 10);
+    if (s.empty() || *end != '\0' || errno != 0) {
+        cerr << "kubsh: test: " << s << ": integer expression expected" << endl;
+        return false;
+    }
+    return true;
+}
+
+static int test_binary(const string& lhs, const string& op, const string& rhs) {
+    if (op == "=" || op == "==") return lhs == rhs ? 0 : 1;
+    if (op == "!=") return lhs != rhs ? 0 : 1;
+
+    static const char* const NUMERIC[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+    int which = -1;
+    for (int i = 0; i < 6; i++) {
+        if (op == NUMERIC[i]) which = i;
+    }
+    if (which < 0) {
+        cerr << "kubsh: test: " << op << ": binary operator expected" << endl;
+        return 2;
+    }
+
+    long long a, b;
+    if (!parse_integer(lhs, a) || !parse_integer(rhs, b)) return 2;
+
+    bool result = false;
+    switch (which) {
+    case 0: result = a == b; break;
+    case 1: result = a != b; break;
+    case 2: result = a < b; break;
+    case 3: result = a <= b; break;
+    case 4: result = a > b; break;
+    case 5: result = a >= b; break;
+    }
+    return result ? 0 : 1;
+}
+
+static int run_test(const string& text, const Frame& frame) {
+    vector<Word> words = split_words(expand_vars(text, frame));
+    vector<string> args;
+    for (const Word& w : words) args.push_back(w.text);
+
+    if (args[0] == "[") {
+        if (args.size() < 2 || args.back() != "]") {
+            cerr << "kubsh: [: missing `]'" << endl;
+            return 2;
+        }
+        args.pop_back();
+    }
+    args.erase(args.begin());
+
+    bool negate = args.size() > 1 && args[0] == "!";
+    if (negate) args.erase(args.begin());
+
+    int result;
+    switch (args.size()) {
+    case 0: result = 1; break;
+    case 1: result = args[0].empty() ? 1 : 0; break;
+    case 2: result = test_unary(args[0], args[1]); break;
+    case 3: result = test_binary(args[0], args[1], args[2]); break;
+    default:
+        cerr << "kubsh: test: too many arguments" << endl;
+        return 2;
+    }
+    if (result == 2) return 2;
+    return negate ? !result : result;
+}
+
+// ==================== Исполнение ====================
+
+enum Flow { FLOW_NORMAL, FLOW_RETURN, FLOW_EXIT };
+
+static Flow execute(const shared_ptr<const Program>& prog, uint32_t pc, Frame& frame, int depth);
+
+static Flow run_source(const vector<Word>& words, const Frame& frame, int depth) {
+    if (words.size() < 2) {
+        cerr << "kubsh: " << words[0].text << ": filename argument required" << endl;
+        last_status = 2;
+        return FLOW_NORMAL;
+    }
+
+    string error;
+    shared_ptr<const Program> prog = load_script(words[1].text, error);
+    if (!prog) {
+        cerr << "kubsh: " << words[1].text << ": " << error << endl;
+        last_status = error.compare(0, 6, "syntax") == 0 ? 2 : 1;
+        return FLOW_NORMAL;
+    }
+
+    // Без аргументов source видит позиционные параметры вызывающего
+    Frame callee;
+    callee.name = frame.name;
+    callee.args = frame.args;
+    if (words.size() > 2) {
+        callee.args.clear();
+        for (size_t i = 2; i < words.size(); i++) callee.args.push_back(words[i].text);
+    }
+
+    last_status = 0;
+    Flow flow = execute(prog, 0, callee, depth + 1);
+    return flow == FLOW_EXIT ? FLOW_EXIT : FLOW_NORMAL;
+}
+
+// Простая команда: функция, source или встроенная/внешняя команда шелла
+static Flow run_simple(const char* text, bool expand, Frame& frame, int depth) {
+    string line = expand ? expand_vars(text, frame) : string(text);
+    string first = line.substr(0, line.find_first_of(" \t"));
+
+    auto fn = functions.find(first);
+    bool is_source = (first == "source" || first == ".");
+    if (fn == functions.end() && !is_source) {
+        last_status = command_runner ? command_runner(line) : 127;
+        return FLOW_NORMAL;
+    }
+
+    if (depth >= MAX_CALL_DEPTH) {
+        cerr << "kubsh: " << first << ": maximum nesting level exceeded" << endl;
+        last_status = 1;
+        return FLOW_NORMAL;
+    }
+
+    vector<Word> words = split_words(line);
+    if (is_source) return run_source(words, frame, depth);
+
+    // Копия: функцию могут переопределить во время ее же выполнения
+    Function callee_fn = fn->second;
+    Frame callee;
+    callee.name = frame.name;
+    for (size_t i = 1; i < words.size(); i++) callee.args.push_back(words[i].text);
+
+    Flow flow = execute(callee_fn.program, callee_fn.entry, callee, depth + 1);
+    return flow == FLOW_EXIT ? FLOW_EXIT : FLOW_NORMAL;
+}
+
+static void for_init(const char* text, Frame& frame) {
+    ForState state;
+    GlobCache glob_cache;
+
+    // "$@" - по элементу на аргумент, даже если в нем пробелы
+    if (strcmp(text, "\"$@\"") == 0) {
+        state.items = frame.args;
+        frame.loops.push_back(move(state));
+        last_status = 0;
+        return;
+    }
+
+    for (Word& w : split_words(expand_vars(text, frame))) {
+        if (w.quoted || !has_glob_chars(w.text)) {
+            state.items.push_back(move(w.text));
+            continue;
+        }
+        vector<string> matches{w.text};
+        expand_globs(matches, glob_cache);
+        for (string& m : matches) state.items.push_back(move(m));
+    }
+
+    frame.loops.push_back(move(state));
+    last_status = 0;
+}
+
+// Блок целиком пишет в файл: подменяем дескрипторы самого шелла,
+// встроенные команды и дети внутри блока получают их как обычные 0/1/2
+static bool redirect_push(const char* text, Frame& frame) {
+    vector<Redirection> redirs;
+    string command, error;
+    if (!split_redirections(expand_vars(text, frame), command, redirs, error)) {
+        cerr << "kubsh: " << error << endl;
+        last_status = 2;
+        return false;
+    }
+
+    IoTarget io;
+    if (!open_redirections(redirs, io)) {
+        last_status = 1;
+        return false;
+    }
+
+    SavedFds saved;
+    install_redirections(io, saved.fd);
+    close_redirections(io);
+    frame.redirs.push_back(saved);
+    return true;
+}
+
+static void redirect_pop(Frame& frame) {
+    const SavedFds& saved = frame.redirs.back();
+    for (int fd = 0; fd < 3; fd++) {
+        if (saved.fd[fd] < 0) continue;
+        dup2(saved.fd[fd], fd);
+        close(saved.fd[fd]);
+    }
+    frame.redirs.pop_back();
+}
+
+static Flow execute_frame(const shared_ptr<const Program>& prog, uint32_t pc, Frame& frame, int depth);
+
+// return/exit изнутри перенаправленного блока не оставляют шелл с чужими дескрипторами
+static Flow execute(const shared_ptr<const Program>& prog, uint32_t pc, Frame& frame, int depth) {
+    Flow flow = execute_frame(prog, pc, frame, depth);
+    while (!frame.redirs.empty()) redirect_pop(frame);
+    return flow;
+}
+
+// Цикл интерпретатора: встроенные конструкции исполняются здесь же,
+// простые команды уходят в command_runner без повторного разбора сценария
+static Flow execute_frame(const shared_ptr<const Program>& prog, uint32_t pc, Frame& frame, int depth) {
+    const Program& p = *prog;
+
+    while (true) {
+        if (running_flag && !*running_flag) return FLOW_EXIT;
+
+        const Instr& in = p.code[pc++];
+        switch (in.op) {
+        case OP_RUN: {
+            Flow flow = run_simple(p.str(in.a), in.b != 0, frame, depth);
+            if (flow != FLOW_NORMAL) return flow;
+            break;
+        }
+        case OP_ASSIGN: {
+            vector<Word> value = split_words(expand_vars(p.str(in.b), frame), false);
+            set_var(p.str(in.a), value.empty() ? "" : value[0].text);
+            last_status = 0;
+            break;
+        }
+        case OP_EXPORT: {
+            string value = var_value(p.str(in.a));
+            if (in.b != 0) {
+                vector<Word> words = split_words(expand_vars(p.str(in.b), frame), false);
+                value = words.empty() ? "" : words[0].text;
+            }
+            setenv(p.str(in.a), value.c_str(), 1);
+            variables.erase(p.str(in.a));
+            last_status = 0;
+            break;
+        }
+        case OP_TEST:
+            last_status = run_test(p.str(in.a), frame);
+            break;
+        case OP_STATUS:
+            last_status = in.a;
+            break;
+        case OP_NOT:
+            last_status = last_status == 0 ? 1 : 0;
+            break;
+        case OP_JUMP:
+            pc = in.a;
+            break;
+        case OP_JUMP_FAIL:
+            if (last_status != 0) pc = in.a;
+            break;
+        case OP_JUMP_OK:
+            if (last_status == 0) pc = in.a;
+            break;
+        case OP_FOR_INIT:
+            for_init(p.str(in.a), frame);
+            break;
+        case OP_FOR_NEXT: {
+            ForState& state = frame.loops.back();
+            if (state.next >= state.items.size()) {
+                pc = in.b;
+            } else {
+                set_var(p.str(in.a), state.items[state.next++]);
+            }
+            break;
+        }
+        case OP_FOR_POP:
+            frame.loops.pop_back();
+            break;
+        case OP_DEFUN:
+            functions[p.str(in.a)] = {prog, in.b};
+            last_status = 0;
+            break;
+        case OP_REDIR_PUSH:
+            if (!redirect_push(p.str(in.a), frame)) pc = in.b;
+            break;
+        case OP_REDIR_POP:
+            redirect_pop(frame);
+            break;
+        case OP_RETURN:
+            last_status = parse_status(p.str(in.a), frame);
+            return FLOW_RETURN;
+        case OP_EXIT:
+            last_status = parse_status(p.str(in.a), frame);
+            return FLOW_EXIT;
+        case OP_HALT:
+            return FLOW_NORMAL;
+        }
+    }
+}
+
+// ==================== Точки входа ====================
+
+void script_init(CommandRunner runner, const volatile sig_atomic_t* running) {
+    command_runner = runner;
+    running_flag = running;
+}
+
+bool script_run_text(const string& text, ScriptResult& result) {
+    shared_ptr<const Program> prog;
+    string error;
+    switch (compile(text, prog, error)) {
+    case COMPILE_INCOMPLETE:
+        return false;
+    case COMPILE_ERROR:
+        cerr << "kubsh: " << error << endl;
+        last_status = 2;
+        result = {last_status, false};
+        return true;
+    case COMPILE_OK:
+        break;
+    }
+
+    Frame frame;
+    frame.name = "kubsh";
+    Flow flow = execute(prog, 0, frame, 0);
+    result = {last_status, flow == FLOW_EXIT};
+    return true;
+}
+
+ScriptResult script_run_file(const string& path, const vector<string>& args) {
+    string error;
+    shared_ptr<const Program> prog = load_script(path, error);
+    if (!prog) {
+        cerr << "kubsh: " << path << ": " << error << endl;
+        return {error.compare(0, 6, "syntax") == 0 ? 2 : 127, true};
+    }
+
+    Frame frame;
+    frame.name = path;
+    frame.args = args;
+    Flow flow = execute(prog, 0, frame, 0);
+    return {last_status, flow == FLOW_EXIT};
+}
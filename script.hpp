@@ -0,0 +1,34 @@
+#pragma once
+
+#include <csignal>
+#include <string>
+#include <vector>
+
+// ==================== Сценарии: управляющие конструкции ====================
+//
+//   if cmd; then ...; elif cmd; then ...; else ...; fi
+//   while cmd; do ...; done        until cmd; do ...; done
+//   for name in words; do ...; done   (break [n], continue [n])
+//   name() { ...; }                function name { ...; }
+//   cmd && cmd || cmd, ! cmd, [ ... ] / test, NAME=value
+//   $?, $#, $@, $0..$9, $NAME, ${NAME}, return [n], exit [n], source / .
+//
+// Текст компилируется в байткод один раз; файлы сценариев кэшируются по mtime.
+
+// Выполняет одну простую команду (встроенную или внешнюю) и возвращает код возврата
+using CommandRunner = int (*)(const std::string& line);
+
+struct ScriptResult {
+    int status = 0;
+    bool exited = false;      // Сработал exit (или шелл завершается по сигналу)
+};
+
+// runner - запуск простых команд; running - флаг работы шелла, сбрасывается по сигналу
+void script_init(CommandRunner runner, const volatile sig_atomic_t* running);
+
+// Выполнить введенный текст. false - блок не закончен (if без fi и т.п.),
+// нужно дочитать строки и вызвать снова со всем текстом.
+bool script_run_text(const std::string& text, ScriptResult& result);
+
+// kubsh script.sh arg...
+ScriptResult script_run_file(const std::string& path, const std::vector<std::string>& args);
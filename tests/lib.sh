@@ -0,0 +1,40 @@
+#!/bin/sh
+# Общие функции тестов. Подключается через ". tests/lib.sh" после KUBSH=...
+#
+# Каждый тест гоняет настоящий бинарник в отдельном HOME без VFS,
+# чтобы не зависеть от FUSE и не трогать историю пользователя.
+
+KUBSH=${KUBSH:?usage: KUBSH=path/to/kubsh sh tests/test_*.sh}
+case $KUBSH in /*) ;; *) KUBSH=$PWD/$KUBSH ;; esac
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT INT TERM
+
+export HOME=$WORK/home
+mkdir -p "$HOME"
+echo 'set vfs.enabled=no' > "$HOME/.kubshrc"
+
+failures=0
+
+# Ввод из stdin, вывод (stdout и stderr вместе) - из kubsh в каталоге $WORK
+kubsh() {
+    (cd "$WORK" && "$KUBSH" "$@" 2>&1)
+}
+
+# expect имя ожидаемое фактическое
+expect() {
+    if [ "$2" = "$3" ]; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1"
+        echo "  expected:"
+        printf '%s\n' "$2" | sed 's/^/    | /'
+        echo "  actual:"
+        printf '%s\n' "$3" | sed 's/^/    | /'
+        failures=$((failures + 1))
+    fi
+}
+
+finish() {
+    [ "$failures" -eq 0 ]
+}
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Прогон всех тестов: tests/run.sh ./kubsh
+#
+# Тест - tests/test_*.sh, печатает "ok"/"FAIL" на проверку
+# и завершается с ненулевым кодом, если что-то не прошло.
+
+KUBSH=${1:?usage: $0 path/to/kubsh}
+export KUBSH
+
+status=0
+for test in "$(dirname "$0")"/test_*.sh; do
+    echo "== $(basename "$test")"
+    sh "$test" || status=1
+done
+
+[ "$status" -eq 0 ] && echo "all tests passed" || echo "some tests FAILED"
+exit $status
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Раскрытие шаблонов имен файлов: *, ?, [...], **, имена на точку
+. "$(dirname "$0")/lib.sh"
+
+G=$WORK/g
+mkdir -p "$G/dir/sub/deep" "$G/other" "$G/.hidden"
+touch "$G/a.txt" "$G/b.txt" "$G/c.log" "$G/ab.txt" "$G/.dot.txt" \
+      "$G/dir/x.txt" "$G/dir/sub/y.txt" "$G/dir/sub/deep/z.txt" "$G/other/w.txt" \
+      "$G/.hidden/h.txt"
+
+# Шаблоны раскрываются относительно текущего каталога.
+# Встроенный echo аргументы не разбирает, поэтому внешний.
+glob() {
+    echo "/bin/echo $1" | (cd "$G" && "$KUBSH" 2>&1)
+}
+
+expect "*" "a.txt ab.txt b.txt c.log dir other" "$(glob '*')"
+expect "*.txt, sorted, no dotfiles" "a.txt ab.txt b.txt" "$(glob '*.txt')"
+expect "?" "a.txt b.txt" "$(glob '?.txt')"
+expect "[ab]" "a.txt b.txt" "$(glob '[ab].txt')"
+expect "[a-c] range" "a.txt b.txt c.log" "$(glob '[a-c].*')"
+expect "[!a] negation" "b.txt c.log" "$(glob '[!a].*')"
+expect "leading dot matches dotfiles" ".dot.txt" "$(glob '.*.txt')"
+expect "*/ keeps directories only" "dir/ other/" "$(glob '*/')"
+expect "dir/*" "dir/sub dir/x.txt" "$(glob 'dir/*')"
+expect "*/*.txt" "dir/x.txt other/w.txt" "$(glob '*/*.txt')"
+expect "** zero or more dirs, skips dot dirs" \
+    "a.txt ab.txt b.txt dir/sub/deep/z.txt dir/sub/y.txt dir/x.txt other/w.txt" "$(glob '**/*.txt')"
+expect "dir/** lists the subtree" \
+    "dir/sub dir/sub/deep dir/sub/deep/z.txt dir/sub/y.txt dir/x.txt" "$(glob 'dir/**')"
+expect "absolute pattern" "$G/a.txt $G/ab.txt" "$(glob "$G/a*.txt")"
+
+# Нет совпадений - слово остается как есть, как в sh
+expect "no match passes through" "*.nothing" "$(glob '*.nothing')"
+expect "unclosed [ is literal" "[a" "$(glob '[a')"
+
+# Список for тоже раскрывается
+out=$(printf 'for f in %s/dir/*.txt %s/*.log; do echo "[$f]"; done\n' "$G" "$G" | kubsh)
+expect "for list" "[$G/dir/x.txt]
+[$G/c.log]" "$out"
+
+finish
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Перенаправления: порядок применения как в POSIX sh
+. "$(dirname "$0")/lib.sh"
+
+printf '#!/bin/sh\necho out\necho err >&2\n' > "$WORK/both"
+chmod +x "$WORK/both"
+
+# 2>&1 > f: stderr - в прежний stdout, в файл - только stdout
+out=$(echo "$WORK/both 2>&1 > $WORK/f1" | kubsh)
+expect "2>&1 > file: stderr to old stdout" "err" "$out"
+expect "2>&1 > file: stdout to file" "out" "$(cat "$WORK/f1")"
+
+# > f 2>&1: оба потока в файл
+out=$(echo "$WORK/both > $WORK/f2 2>&1" | kubsh)
+expect "> file 2>&1: nothing on terminal" "" "$out"
+expect "> file 2>&1: both in file" "out
+err" "$(cat "$WORK/f2")"
+
+# То же для встроенной команды
+echo "echo builtin 2>&1 > $WORK/f3" | kubsh > /dev/null
+expect "builtin > file" "builtin" "$(cat "$WORK/f3")"
+
+echo "echo first > $WORK/f4" | kubsh > /dev/null
+echo "echo second >> $WORK/f4" | kubsh > /dev/null
+expect ">> appends" "first
+second" "$(cat "$WORK/f4")"
+
+finish
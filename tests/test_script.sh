@@ -0,0 +1,140 @@
+#!/bin/sh
+# Интерпретатор сценариев: ветвления, циклы, функции, $?, перенаправления блоков
+. "$(dirname "$0")/lib.sh"
+
+# if / elif / else
+out=$(kubsh <<'KUBSH'
+for n in 1 2 3; do
+    if [ $n = 1 ]; then
+        echo one
+    elif [ $n = 2 ]; then
+        echo two
+    else
+        echo other
+    fi
+done
+KUBSH
+)
+expect "if/elif/else" "one
+two
+other" "$out"
+
+# while / until
+out=$(kubsh <<'KUBSH'
+i=0
+while [ $i != 3 ]; do
+    echo w$i
+    if [ $i = 0 ]; then i=1; elif [ $i = 1 ]; then i=2; else i=3; fi
+done
+until [ $i = 0 ]; do echo u$i; i=0; done
+KUBSH
+)
+expect "while/until" "w0
+w1
+w2
+u3" "$out"
+
+# break N / continue
+out=$(kubsh <<'KUBSH'
+for a in x y; do
+    for b in 1 2 3; do
+        if [ $b = 2 ]; then continue; fi
+        if [ $a = y ]; then break 2; fi
+        echo $a$b
+    done
+done
+echo after
+KUBSH
+)
+expect "break 2 / continue" "x1
+x3
+after" "$out"
+
+# Функции, аргументы, return и $?
+out=$(kubsh <<'KUBSH'
+greet() {
+    echo "hi $1 ($#)"
+    return 3
+}
+function check { [ "$1" = yes ]; }
+greet bob extra
+echo status=$?
+check yes && echo yes-ok
+check no || echo no-failed
+false
+echo false=$?
+KUBSH
+)
+expect "functions, return, \$?" "hi bob (2)
+status=3
+yes-ok
+no-failed
+false=1" "$out"
+
+# Перенаправление целого блока, порядок как в sh
+out=$(kubsh <<KUBSH
+for i in 1 2; do echo line\$i; done > $WORK/loop.txt
+{ echo out; ls $WORK/missing; } 2>&1 > $WORK/block.txt
+echo back
+KUBSH
+)
+expect "block redirect restores stdout" "ls: cannot access '$WORK/missing': No such file or directory
+back" "$out"
+expect "done > file" "line1
+line2" "$(cat "$WORK/loop.txt")"
+expect "} 2>&1 > file: only stdout in file" "out" "$(cat "$WORK/block.txt")"
+
+# break/continue изнутри перенаправленного блока восстанавливают stdout шелла
+# (в одном тексте: по его окончании шелл снимает перенаправления и сам)
+cat > "$WORK/jump.sh" <<KUBSH
+for i in 1 2; do { echo in\$i; break; } > $WORK/brk.txt; done
+echo after-break
+for i in 1 2; do
+    for j in a b; do
+        if true; then echo \$i\$j; continue 2; fi > $WORK/cont.txt
+    done
+done
+echo after-continue
+KUBSH
+out=$(kubsh "$WORK/jump.sh")
+expect "break out of redirected block" "after-break
+after-continue" "$out"
+expect "break: block output in file" "in1" "$(cat "$WORK/brk.txt")"
+expect "continue 2: block output in file" "2a" "$(cat "$WORK/cont.txt")"
+
+# Незакрытый блок в файле - ошибка разбора с кодом 2
+printf 'if true; then\n    echo never\n' > "$WORK/broken.sh"
+out=$(kubsh "$WORK/broken.sh")
+status=$?
+expect "unterminated if: message" "kubsh: $WORK/broken.sh: syntax error: unexpected end of file" "$out"
+expect "unterminated if: status" "2" "$status"
+
+# kubsh script.sh args и exit N
+printf 'echo "$0 $# $1 $2"\nexit 7\necho unreachable\n' > "$WORK/args.sh"
+out=$(kubsh "$WORK/args.sh" a b)
+status=$?
+expect "script args" "$WORK/args.sh 2 a b" "$out"
+expect "exit N" "7" "$status"
+
+# Смена PATH в сценарии сбрасывает хэш команд.
+# sleep дает фоновому хэшу достроиться, иначе поиск идет мимо него.
+mkdir -p "$WORK/p1" "$WORK/p2"
+printf '#!/bin/sh\necho p1\n' > "$WORK/p1/tool"
+printf '#!/bin/sh\necho p2\n' > "$WORK/p2/tool"
+chmod +x "$WORK/p1/tool" "$WORK/p2/tool"
+out=$(PATH=$WORK/p1:$PATH kubsh <<KUBSH
+tool
+/bin/sleep 0.5
+tool
+PATH=$WORK/p2:/usr/bin:/bin
+tool
+export PATH=$WORK/p1:/usr/bin:/bin
+tool
+KUBSH
+)
+expect "PATH change rehashes commands" "p1
+p1
+p2
+p1" "$out"
+
+finish
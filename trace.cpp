@@ -0,0 +1,51 @@
+#include "trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace std;
+
+// Отсчет от статической инициализации - раньше main
+static const chrono::steady_clock::time_point process_start = chrono::steady_clock::now();
+static atomic<bool> enabled{false};
+
+static long long now_ns() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - process_start).count();
+}
+
+// Одна строка - один write, чтобы строки из разных потоков не перемешивались
+static void print_line(const char* name, long long start_ns, long long duration_ns) {
+    char line[128];
+    int len;
+    if (duration_ns < 0) {
+        len = snprintf(line, sizeof(line), "startup: +%8.3f ms  %s\n", start_ns / 1e6, name);
+    } else {
+        len = snprintf(line, sizeof(line), "startup: +%8.3f ms  %-16s %8.3f ms\n",
+                       start_ns / 1e6, name, duration_ns / 1e6);
+    }
+    if (len > 0) {
+        ssize_t n = write(STDERR_FILENO, line, len);
+        (void)n;
+    }
+}
+
+void trace_enable() {
+    enabled = true;
+}
+
+bool trace_enabled() {
+    return enabled;
+}
+
+void trace_mark(const char* name) {
+    if (enabled) print_line(name, now_ns(), -1);
+}
+
+TracePhase::TracePhase(const char* phase_name) : name(phase_name), start_ns(now_ns()) {
+}
+
+TracePhase::~TracePhase() {
+    if (enabled) print_line(name, start_ns, now_ns() - start_ns);
+}
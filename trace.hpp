@@ -0,0 +1,20 @@
+#pragma once
+
+// ==================== Трассировка запуска (--startup-trace) ====================
+
+// Включить печать фаз запуска в stderr
+void trace_enable();
+bool trace_enabled();
+
+// Отметка момента (например, "first prompt") относительно старта процесса
+void trace_mark(const char* name);
+
+// Фаза запуска: при выходе из области видимости печатает,
+// когда она началась и сколько длилась. Можно использовать из любых потоков.
+struct TracePhase {
+    explicit TracePhase(const char* name);
+    ~TracePhase();
+
+    const char* name;
+    long long start_ns;
+};
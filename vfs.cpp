@@ -8,10 +8,29 @@
 #include <cerrno>          
 #include <ctime>           
 #include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <shadow.h>        // lckpwdf
 #include "vfs.hpp"         //  fuse_start 
 #include <sys/wait.h>      // waitpid
 #include <fuse3/fuse.h>
+#include <fuse3/fuse_lowlevel.h>  // fuse_session_* для событийного цикла
 #include <pthread.h>       // Потоки
+#include <signal.h>
+#include <poll.h>
+#include <deque>
+#include <sys/eventfd.h>
+#include <fcntl.h>         // O_ACCMODE
+#include <algorithm>
 
 // ============================================================================
 // ВСПОМОГАТЕЛЬНЫЕ ФУНКЦИИ
@@ -21,6 +40,11 @@ int run_cmd(const char* cmd, char* const argv[]) {
     pid_t pid = fork();
 
     if (pid == 0) {
+        // В режиме событийного цикла сигналы заблокированы - ребенку они нужны
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, nullptr);
+
         execvp(cmd, argv);  // Выполнили - отдали управление
         _exit(127);         // Иначе ошибка
     }
@@ -35,6 +59,13 @@ int run_cmd(const char* cmd, char* const argv[]) {
     return -1;
 }
 
+// Служебные потоки VFS не должны забирать себе SIGINT/SIGHUP у шелла
+static void block_thread_signals() {
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, nullptr);
+}
+
 // Для проверки на "правильность" шелла
 // pwd - структура passwd, в которой есть указатели на конкретные данные из файла
 bool valid_shell(struct passwd* pwd) {
@@ -46,6 +77,631 @@ bool valid_shell(struct passwd* pwd) {
     return (len >= 2 && strcmp(pwd->pw_shell + len - 2, "sh") == 0);
 }
 
+// ============================================================================
+// СНИМОК ПОЛЬЗОВАТЕЛЕЙ И ИНДЕКС ГРУПП
+// ============================================================================
+
+// Файлы внутри /opt/users/<user>/
+static const char* const USER_FILES[] = {"id", "home", "shell", "gid", "gecos", "groups", "sudo"};
+
+// Группы, членство в которых дает sudo
+static const char* const SUDO_GROUPS[] = {"sudo", "wheel", "admin"};
+
+struct UserRecord {
+    std::string name;
+    uid_t uid;
+    gid_t gid;
+    std::string gecos;
+    std::string home;
+    std::string shell;
+    bool listed;            // Показывается в readdir (valid_shell)
+};
+
+// Содержимое, которое дорого считать: вычисляется при первом чтении
+// и живет, пока жив снимок
+struct LazyUserFiles {
+    std::once_flag once;
+    std::string groups;
+    std::string sudo;
+};
+
+// По этим полям понимаем, что файл поменялся (в том числе заменен через rename)
+struct FileStamp {
+    ino_t ino = 0;
+    off_t size = 0;
+    struct timespec mtime = {0, 0};
+
+    bool operator==(const FileStamp& o) const {
+        return ino == o.ino && size == o.size &&
+               mtime.tv_sec == o.mtime.tv_sec && mtime.tv_nsec == o.mtime.tv_nsec;
+    }
+};
+
+// Неизменяемый снимок passwd + group. Пересобирается целиком, если поменялся
+// любой из файлов, поэтому ленивый кэш сбрасывается вместе с ним.
+struct UserSnapshot {
+    FileStamp passwd_stamp;
+    FileStamp group_stamp;
+
+    std::vector<UserRecord> users;
+    std::unordered_map<std::string, size_t> by_name;
+    // Индексы пользователей, которые видны в readdir корня, в порядке passwd
+    std::vector<size_t> listed;
+
+    // Имя группы по gid и обратный индекс: пользователь -> дополнительные группы
+    std::unordered_map<gid_t, std::string> group_names;
+    std::unordered_map<std::string, std::vector<gid_t>> member_of;
+
+    std::unique_ptr<LazyUserFiles[]> lazy;
+
+    const UserRecord* find(const char* name) const {
+        auto it = by_name.find(name);
+        return it == by_name.end() ? nullptr : &users[it->second];
+    }
+};
+
+static std::mutex snapshot_mutex;
+static std::shared_ptr<const UserSnapshot> snapshot;
+
+static FileStamp stamp_of(const char* path) {
+    FileStamp st;
+    struct stat sb;
+    if (stat(path, &sb) == 0) {
+        st.ino = sb.st_ino;
+        st.size = sb.st_size;
+        st.mtime = sb.st_mtim;
+    }
+    return st;
+}
+
+// Один проход по /etc/group: имена групп и обратный индекс членства
+static void load_groups(UserSnapshot& snap) {
+    std::ifstream group_file("/etc/group");
+    std::string line;
+
+    while (std::getline(group_file, line)) {
+        // name:password:gid:member1,member2
+        size_t p1 = line.find(':');
+        size_t p2 = (p1 == std::string::npos) ? p1 : line.find(':', p1 + 1);
+        size_t p3 = (p2 == std::string::npos) ? p2 : line.find(':', p2 + 1);
+        if (p3 == std::string::npos) continue;
+
+        gid_t gid = (gid_t) std::strtoul(line.c_str() + p2 + 1, nullptr, 10);
+        snap.group_names.emplace(gid, line.substr(0, p1));
+
+        size_t pos = p3 + 1;
+        while (pos < line.size()) {
+            size_t comma = line.find(',', pos);
+            if (comma == std::string::npos) comma = line.size();
+            if (comma > pos) {
+                snap.member_of[line.substr(pos, comma - pos)].push_back(gid);
+            }
+            pos = comma + 1;
+        }
+    }
+}
+
+static std::shared_ptr<const UserSnapshot> build_snapshot(const FileStamp& passwd_stamp,
+                                                          const FileStamp& group_stamp) {
+    auto snap = std::make_shared<UserSnapshot>();
+    snap->passwd_stamp = passwd_stamp;
+    snap->group_stamp = group_stamp;
+
+    struct passwd* pwd;
+    setpwent();
+    while ((pwd = getpwent()) != NULL) {
+        if (snap->by_name.count(pwd->pw_name)) continue;
+
+        snap->by_name.emplace(pwd->pw_name, snap->users.size());
+        snap->users.push_back(UserRecord{
+            pwd->pw_name, pwd->pw_uid, pwd->pw_gid,
+            pwd->pw_gecos ? pwd->pw_gecos : "",
+            pwd->pw_dir ? pwd->pw_dir : "",
+            pwd->pw_shell ? pwd->pw_shell : "",
+            valid_shell(pwd)
+        });
+        if (snap->users.back().listed) {
+            snap->listed.push_back(snap->users.size() - 1);
+        }
+    }
+    endpwent();
+
+    load_groups(*snap);
+    snap->lazy.reset(new LazyUserFiles[snap->users.size()]);
+    return snap;
+}
+
+// Текущий снимок. Два stat на вызов, пересборка только если файлы поменялись.
+static std::shared_ptr<const UserSnapshot> current_snapshot() {
+    FileStamp passwd_stamp = stamp_of("/etc/passwd");
+    FileStamp group_stamp = stamp_of("/etc/group");
+
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    if (!snapshot ||
+        !(snapshot->passwd_stamp == passwd_stamp) ||
+        !(snapshot->group_stamp == group_stamp)) {
+        snapshot = build_snapshot(passwd_stamp, group_stamp);
+    }
+    return snapshot;
+}
+
+static void compute_lazy_files(const UserSnapshot& snap, const UserRecord& user, LazyUserFiles& lazy) {
+    // Основная группа первой, затем дополнительные - как у id -Gn
+    std::vector<gid_t> gids = {user.gid};
+    auto it = snap.member_of.find(user.name);
+    if (it != snap.member_of.end()) {
+        for (gid_t gid : it->second) {
+            if (gid != user.gid) gids.push_back(gid);
+        }
+    }
+
+    bool sudo = false;
+    for (gid_t gid : gids) {
+        auto name_it = snap.group_names.find(gid);
+        std::string name = (name_it != snap.group_names.end()) ? name_it->second : std::to_string(gid);
+
+        if (!lazy.groups.empty()) lazy.groups += ' ';
+        lazy.groups += name;
+
+        for (const char* sudo_group : SUDO_GROUPS) {
+            if (name == sudo_group) sudo = true;
+        }
+    }
+    lazy.sudo = sudo ? "1" : "0";
+}
+
+// ============================================================================
+// ЗАПИСЬ shell/home С ОТЛОЖЕННЫМ СБРОСОМ В PASSWD
+// ============================================================================
+
+// Изменения копятся в памяти и сбрасываются одной атомарной перезаписью
+// /etc/passwd по таймеру или по fsync. 10k смен шелла = одна перезапись файла.
+
+static const char* const PASSWD_PATH = "/etc/passwd";
+static const char* const PASSWD_TMP_PATH = "/etc/passwd.kubsh-tmp";
+
+// Через сколько после первого изменения сбрасываем накопленное
+static std::atomic<int> writeback_delay_ms{200};
+
+struct PendingUser {
+    bool has_home = false;
+    bool has_shell = false;
+    std::string home;
+    std::string shell;
+};
+
+static std::mutex pending_mutex;
+// Не разрушается при выходе: на нем может спать поток-таймер,
+// а деструктор condition_variable с ожидающими потоками зависает
+static std::condition_variable& pending_cv = *new std::condition_variable;
+// Закрытые и проверенные изменения, ждущие сброса в passwd
+static std::unordered_map<std::string, PendingUser> pending;
+// Изменения, которые прямо сейчас пишутся в passwd (видны до rename)
+static std::unordered_map<std::string, PendingUser> inflight;
+static bool writeback_thread_started = false;
+
+// Сериализует перезаписи passwd между таймером и fsync
+static std::mutex writeback_mutex;
+
+// shell и home - это пути; больше PATH_MAX в passwd не положить
+static const size_t MAX_DRAFT_SIZE = 4096;
+
+// Открытый на запись shell/home. Черновик живет в дескрипторе и уходит вместе с ним:
+// открыли и не писали (touch, exec 3>>shell) - ничего не остается и не прячет passwd.
+struct WriteHandle {
+    std::string username;
+    std::string filename;
+    std::string draft;
+    bool seeded = false;       // draft заведен первой записью (или O_TRUNC)
+    bool dirty = false;        // Есть изменения, еще не отданные в commit_draft
+};
+
+static bool is_writable_file(const char* filename) {
+    return std::strcmp(filename, "shell") == 0 || std::strcmp(filename, "home") == 0;
+}
+
+// Видим свои изменения до сброса: закрытые, но еще не записанные в passwd
+static bool pending_value(const std::string& username, const char* filename, std::string& out) {
+    std::lock_guard<std::mutex> lock(pending_mutex);
+
+    for (auto* changes : {&pending, &inflight}) {
+        auto it = changes->find(username);
+        if (it == changes->end()) continue;
+
+        if (filename[0] == 's' && it->second.has_shell) {
+            out = it->second.shell;
+            return true;
+        }
+        if (filename[0] == 'h' && it->second.has_home) {
+            out = it->second.home;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Разбивает строку passwd на 7 полей
+static bool split_passwd_line(const std::string& line, std::vector<std::string>& fields) {
+    fields.clear();
+    std::stringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, ':')) {
+        fields.push_back(field);
+    }
+    if (!line.empty() && line.back() == ':') fields.push_back("");
+    return fields.size() == 7;
+}
+
+// Одна перезапись passwd под lckpwdf: пишем во временный файл рядом и делаем rename
+static int rewrite_passwd(const std::unordered_map<std::string, PendingUser>& changes) {
+    if (lckpwdf() != 0) return -EBUSY;
+
+    int result = 0;
+    std::string out;
+    struct stat orig;
+
+    std::ifstream in(PASSWD_PATH);
+    if (!in || stat(PASSWD_PATH, &orig) != 0) {
+        ulckpwdf();
+        return -EIO;
+    }
+
+    std::string line;
+    std::vector<std::string> fields;
+    while (std::getline(in, line)) {
+        if (split_passwd_line(line, fields)) {
+            auto it = changes.find(fields[0]);
+            if (it != changes.end()) {
+                if (it->second.has_home) fields[5] = it->second.home;
+                if (it->second.has_shell) fields[6] = it->second.shell;
+
+                line = fields[0];
+                for (size_t i = 1; i < fields.size(); i++) {
+                    line += ':';
+                    line += fields[i];
+                }
+            }
+        }
+        out += line;
+        out += '\n';
+    }
+    in.close();
+
+    int fd = open(PASSWD_TMP_PATH, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, orig.st_mode & 07777);
+    if (fd < 0) {
+        ulckpwdf();
+        return -errno;
+    }
+
+    size_t done = 0;
+    while (done < out.size()) {
+        ssize_t n = write(fd, out.data() + done, out.size() - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            result = -errno;
+            break;
+        }
+        done += n;
+    }
+
+    if (result == 0 && fchown(fd, orig.st_uid, orig.st_gid) != 0) result = -errno;
+    if (result == 0 && fsync(fd) != 0) result = -errno;
+    close(fd);
+
+    if (result == 0 && rename(PASSWD_TMP_PATH, PASSWD_PATH) != 0) result = -errno;
+    if (result != 0) unlink(PASSWD_TMP_PATH);
+
+    ulckpwdf();
+    return result;
+}
+
+// Забирает все накопленные изменения и пишет их одной перезаписью.
+// При ошибке возвращает изменения обратно (не затирая более новые).
+static int writeback_pending() {
+    std::lock_guard<std::mutex> wb_lock(writeback_mutex);
+
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        if (pending.empty()) return 0;
+        inflight.swap(pending);
+    }
+
+    int result = rewrite_passwd(inflight);
+
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    if (result != 0) {
+        for (auto& [name, change] : inflight) {
+            pending.emplace(name, std::move(change));
+        }
+    }
+    inflight.clear();
+    return result;
+}
+
+// Поток-таймер: ждет первое изменение, дает накопиться еще writeback_delay_ms
+// и сбрасывает все разом
+static void writeback_thread_function() {
+    block_thread_signals();
+
+    std::unique_lock<std::mutex> lock(pending_mutex);
+    while (true) {
+        pending_cv.wait(lock, [] { return !pending.empty(); });
+
+        // Новые изменения будят поток, но срок не сдвигают
+        auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(writeback_delay_ms.load());
+        while (std::chrono::steady_clock::now() < deadline) {
+            pending_cv.wait_until(lock, deadline);
+        }
+
+        lock.unlock();
+        if (writeback_pending() != 0) {
+            // passwd занят или недоступен - повторим через задержку
+            std::this_thread::sleep_for(std::chrono::milliseconds(writeback_delay_ms.load()));
+        }
+        lock.lock();
+    }
+}
+
+// Проверяет черновик и переводит его в очередь на сброс
+static int commit_draft(const std::string& username, const char* filename, std::string value) {
+    while (!value.empty() && (value.back() == '\n' || value.back() == ' ')) {
+        value.pop_back();
+    }
+
+    // Абсолютный путь без разделителей passwd
+    if (value.empty() || value[0] != '/' ||
+        value.find(':') != std::string::npos || value.find('\n') != std::string::npos) {
+        return -EINVAL;
+    }
+
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    PendingUser& change = pending[username];
+    if (filename[0] == 's') {
+        change.has_shell = true;
+        change.shell = value;
+    } else {
+        change.has_home = true;
+        change.home = value;
+    }
+
+    if (!writeback_thread_started) {
+        writeback_thread_started = true;
+        std::thread(writeback_thread_function).detach();
+    }
+    pending_cv.notify_one();
+    return 0;
+}
+
+void vfs_sync() {
+    writeback_pending();
+}
+
+void vfs_set_writeback_delay(int ms) {
+    writeback_delay_ms = ms;
+}
+
+// Содержимое файла пользователя. -ENOENT если такого файла нет.
+static int user_file_content(const UserSnapshot& snap, const UserRecord& user,
+                             const char* filename, std::string& out) {
+    if (is_writable_file(filename) && pending_value(user.name, filename, out)) {
+        return 0;
+    }
+
+    if (std::strcmp(filename, "id") == 0) {
+        out = std::to_string(user.uid);
+    } else if (std::strcmp(filename, "home") == 0) {
+        out = user.home;
+    } else if (std::strcmp(filename, "shell") == 0) {
+        out = user.shell;
+    } else if (std::strcmp(filename, "gid") == 0) {
+        out = std::to_string(user.gid);
+    } else if (std::strcmp(filename, "gecos") == 0) {
+        out = user.gecos;
+    } else if (std::strcmp(filename, "groups") == 0 || std::strcmp(filename, "sudo") == 0) {
+        LazyUserFiles& lazy = snap.lazy[&user - snap.users.data()];
+        std::call_once(lazy.once, compute_lazy_files, std::cref(snap), std::cref(user), std::ref(lazy));
+        out = (filename[0] == 'g') ? lazy.groups : lazy.sudo;
+    } else {
+        return -ENOENT;
+    }
+    return 0;
+}
+
+// ============================================================================
+// СТАТИСТИКА ОПЕРАЦИЙ
+// ============================================================================
+
+// Виртуальный файл со статистикой в корне точки монтирования
+static const char* const STATS_PATH = "/.stats";
+
+enum VfsOp { OP_GETATTR, OP_READDIR, OP_READ, OP_MKDIR, OP_RMDIR, OP_COUNT };
+static const char* const OP_NAMES[OP_COUNT] = {"getattr", "readdir", "read", "mkdir", "rmdir"};
+
+// Гистограмма задержек по степеням двойки: корзина i - от 2^i до 2^(i+1) нс
+static const int LATENCY_BUCKETS = 40;
+
+struct OpCounters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> total_ns{0};
+    std::atomic<uint64_t> buckets[LATENCY_BUCKETS] = {};
+};
+
+// Счетчики одного потока. Пишет в них только сам поток, поэтому обходимся без
+// атомарных RMW, а выравнивание по кэш-линии не дает потокам пула делить линию.
+struct alignas(64) ThreadStats {
+    OpCounters ops[OP_COUNT];
+};
+
+// Сумма по всем потокам
+struct OpTotals {
+    uint64_t calls = 0;
+    uint64_t errors = 0;
+    uint64_t total_ns = 0;
+    uint64_t buckets[LATENCY_BUCKETS] = {};
+};
+
+// Потоки FUSE могут пережить статические объекты, поэтому мьютекс и списки в куче.
+// stats_slots - слоты живых потоков, stats_free - обнуленные слоты завершившихся.
+static std::mutex& stats_mutex = *new std::mutex;
+static std::vector<ThreadStats*>& stats_slots = *new std::vector<ThreadStats*>;
+static std::vector<ThreadStats*>& stats_free = *new std::vector<ThreadStats*>;
+
+// Счетчики завершившихся потоков, чтобы суммы не уменьшались
+static OpTotals stats_retired[OP_COUNT];
+
+// Сброс не трогает чужие счетчики: запоминаем суммы и вычитаем их при выводе
+static OpTotals stats_baseline[OP_COUNT];
+
+static void add_counters(OpTotals totals[OP_COUNT], const ThreadStats& slot) {
+    for (int op = 0; op < OP_COUNT; op++) {
+        const OpCounters& c = slot.ops[op];
+        totals[op].calls += c.calls.load(std::memory_order_relaxed);
+        totals[op].errors += c.errors.load(std::memory_order_relaxed);
+        totals[op].total_ns += c.total_ns.load(std::memory_order_relaxed);
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            totals[op].buckets[b] += c.buckets[b].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// При выходе потока его счетчики переносятся в stats_retired, а слот уходит
+// на переиспользование - иначе пул и потоки libfuse копили бы слоты без конца
+struct StatsSlotOwner {
+    ThreadStats* slot = nullptr;
+
+    ~StatsSlotOwner() {
+        if (!slot) return;
+
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        add_counters(stats_retired, *slot);
+        for (OpCounters& c : slot->ops) {
+            c.calls.store(0, std::memory_order_relaxed);
+            c.errors.store(0, std::memory_order_relaxed);
+            c.total_ns.store(0, std::memory_order_relaxed);
+            for (auto& bucket : c.buckets) bucket.store(0, std::memory_order_relaxed);
+        }
+        stats_slots.erase(std::find(stats_slots.begin(), stats_slots.end(), slot));
+        stats_free.push_back(slot);
+    }
+};
+
+static thread_local StatsSlotOwner thread_stats;
+
+static ThreadStats& local_stats() {
+    if (!thread_stats.slot) {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        if (stats_free.empty()) {
+            thread_stats.slot = new ThreadStats;
+        } else {
+            thread_stats.slot = stats_free.back();
+            stats_free.pop_back();
+        }
+        stats_slots.push_back(thread_stats.slot);
+    }
+    return *thread_stats.slot;
+}
+
+static void bump(std::atomic<uint64_t>& counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void stats_record(VfsOp op, uint64_t start_ns, int result) {
+    uint64_t ns = monotonic_ns() - start_ns;
+    int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+    if (bucket >= LATENCY_BUCKETS) bucket = LATENCY_BUCKETS - 1;
+
+    OpCounters& c = local_stats().ops[op];
+    bump(c.calls, 1);
+    if (result < 0) bump(c.errors, 1);
+    bump(c.total_ns, ns);
+    bump(c.buckets[bucket], 1);
+}
+
+// Обертка над колбэком FUSE: замеряет время и считает ошибки
+template <VfsOp op, auto fn> struct Timed;
+
+template <VfsOp op, typename... Args, int (*fn)(Args...)>
+struct Timed<op, fn> {
+    static int call(Args... args) {
+        uint64_t start = monotonic_ns();
+        int result = fn(args...);
+        stats_record(op, start, result);
+        return result;
+    }
+};
+
+// Вызывается под stats_mutex
+static void collect_stats(OpTotals totals[OP_COUNT]) {
+    for (int op = 0; op < OP_COUNT; op++) {
+        totals[op] = stats_retired[op];
+    }
+    for (const ThreadStats* slot : stats_slots) {
+        add_counters(totals, *slot);
+    }
+}
+
+// Верхняя граница корзины, в которую попал заданный процентиль, в микросекундах
+static double percentile_us(const OpTotals& t, double q) {
+    if (t.calls == 0) return 0;
+
+    uint64_t rank = (uint64_t) (q * t.calls);
+    if (rank >= t.calls) rank = t.calls - 1;
+
+    uint64_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += t.buckets[b];
+        if (seen > rank) return (double) (2ull << b) / 1000.0;
+    }
+    return (double) (2ull << (LATENCY_BUCKETS - 1)) / 1000.0;
+}
+
+std::string vfs_stats_report() {
+    OpTotals totals[OP_COUNT];
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        collect_stats(totals);
+        for (int op = 0; op < OP_COUNT; op++) {
+            totals[op].calls -= stats_baseline[op].calls;
+            totals[op].errors -= stats_baseline[op].errors;
+            totals[op].total_ns -= stats_baseline[op].total_ns;
+            for (int b = 0; b < LATENCY_BUCKETS; b++) {
+                totals[op].buckets[b] -= stats_baseline[op].buckets[b];
+            }
+        }
+    }
+
+    // Одна строка на операцию, поля key=value - удобно и читать, и разбирать скриптом
+    std::string out;
+    char line[256];
+    for (int op = 0; op < OP_COUNT; op++) {
+        const OpTotals& t = totals[op];
+        double avg_us = t.calls ? (double) t.total_ns / t.calls / 1000.0 : 0;
+        std::snprintf(line, sizeof(line),
+                      "%-8s calls=%llu errors=%llu avg_us=%.1f p50_us=%.1f p99_us=%.1f p999_us=%.1f\n",
+                      OP_NAMES[op], (unsigned long long) t.calls, (unsigned long long) t.errors,
+                      avg_us, percentile_us(t, 0.50), percentile_us(t, 0.99), percentile_us(t, 0.999));
+        out += line;
+    }
+    return out;
+}
+
+void vfs_stats_reset() {
+    OpTotals totals[OP_COUNT];
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    collect_stats(totals);
+    for (int op = 0; op < OP_COUNT; op++) {
+        stats_baseline[op] = totals[op];
+    }
+}
+
 // ============================================================================
 // FUSE ОПЕРАЦИИ
 // ============================================================================
@@ -69,6 +725,16 @@ int users_getattr(const char* path, struct stat* st, struct fuse_file_info* fi)
         return 0;
     }
 
+    // Статистика только для чтения; размер - длина на текущий момент,
+    // читается она с direct_io, так что ядро не обрежет выросший файл
+    if (strcmp(path, STATS_PATH) == 0) {
+        st->st_mode = S_IFREG | 0444;
+        st->st_uid = getuid();
+        st->st_gid = getgid();
+        st->st_size = vfs_stats_report().size();
+        return 0;
+    }
+
     char username[256];
     char filename[256];
 
@@ -76,35 +742,33 @@ int users_getattr(const char* path, struct stat* st, struct fuse_file_info* fi)
     // Разбиваем path на /...(255)/...
     // Если удачно то кладем первую часть в username, вторую в filename 
     if (sscanf(path, "/%255[^/]/%255[^/]", username, filename) == 2) {
-        // getpwnam ищем в pwd пользователя username
-        struct passwd* pwd = getpwnam(username);
+        // Ищем пользователя username в снимке passwd
+        auto snap = current_snapshot();
+        const UserRecord* user = snap->find(username);
+        if (user == NULL) return -ENOENT;
 
-        // Если файл это id/home/shell, иначе файл не найден
-        if (strcmp(filename, "id") != 0 &&
-            strcmp(filename, "home") != 0 &&
-            strcmp(filename, "shell") != 0) {
-            return -ENOENT;
-        }
+        // Размер - реальная длина содержимого, иначе ядро обрежет чтение
+        std::string content;
+        int err = user_file_content(*snap, *user, filename, content);
+        if (err != 0) return err;
 
-        // Если нашли в pwd(то есть не NULL)
-        if (pwd != NULL) {
-            st->st_mode = S_IFREG | 0644;  // Обычный файл с правами rw-r--r--
-            st->st_uid = pwd->pw_uid;      // Владелец - пользователь
-            st->st_gid = pwd->pw_gid;
-            st->st_size = 256;             // Размер файла 256 байт
-            return 0;
-        }
-        return -ENOENT;
+        // shell и home можно писать (rw-r--r--), остальное только читать
+        st->st_mode = S_IFREG | (is_writable_file(filename) ? 0644 : 0444);
+        st->st_uid = user->uid;        // Владелец - пользователь
+        st->st_gid = user->gid;
+        st->st_size = content.size();
+        return 0;
     }
 
     // Директории пользователей
     // Если разбили path только на /...
     if (sscanf(path, "/%255[^/]", username) == 1) {
-        struct passwd* pwd = getpwnam(username);
-        if (pwd != NULL) {
+        auto snap = current_snapshot();
+        const UserRecord* user = snap->find(username);
+        if (user != NULL) {
             st->st_mode = S_IFDIR | 0755;
-            st->st_uid = pwd->pw_uid;  // Владелец - пользователь
-            st->st_gid = pwd->pw_gid;
+            st->st_uid = user->uid;  // Владелец - пользователь
+            st->st_gid = user->gid;
             return 0;
         }
         return -ENOENT;
@@ -113,6 +777,70 @@ int users_getattr(const char* path, struct stat* st, struct fuse_file_info* fi)
     return -ENOENT;
 }
 
+// Открытый листинг корня: держит снимок, с которого начали, поэтому
+// смещения (cookie) записей стабильны между вызовами readdir
+struct DirHandle {
+    std::shared_ptr<const UserSnapshot> snap;
+};
+
+int users_opendir(const char* path, struct fuse_file_info* fi) {
+    fi->fh = 0;
+    if (std::strcmp(path, "/") == 0) {
+        fi->fh = reinterpret_cast<uint64_t>(new DirHandle{current_snapshot()});
+    }
+    return 0;
+}
+
+int users_releasedir(const char* path, struct fuse_file_info* fi) {
+    (void) path;
+    delete reinterpret_cast<DirHandle*>(fi->fh);
+    fi->fh = 0;
+    return 0;
+}
+
+// Листинг корня потоком из снимка.
+// Cookie записи = ее номер + 1: "." -> 1, ".." -> 2, ".stats" -> 3, i-й пользователь -> i + 4.
+// Повторный вызов с offset продолжает с нужного места за O(1), без нового прохода по passwd.
+static int readdir_root(void* buf, fuse_fill_dir_t filler, off_t offset,
+                        struct fuse_file_info* fi, enum fuse_readdir_flags flags) {
+    DirHandle* dir = fi ? reinterpret_cast<DirHandle*>(fi->fh) : nullptr;
+    std::shared_ptr<const UserSnapshot> snap = dir ? dir->snap : current_snapshot();
+
+    // READDIR_PLUS: ядро получает записи вместе с атрибутами одним ответом и не шлет
+    // LOOKUP на каждое имя при ls -l. Высокоуровневый libfuse все равно делает свой
+    // lookup (наш getattr) на каждую запись, чтобы завести узел, - это поиск по снимку
+    // в памяти, без обращения к passwd.
+    bool plus = (flags & FUSE_READDIR_PLUS) != 0;
+    enum fuse_fill_dir_flags fill_flags = plus ? FUSE_FILL_DIR_PLUS : (enum fuse_fill_dir_flags) 0;
+
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFDIR | 0755;
+    st.st_uid = getuid();
+    st.st_gid = getgid();
+
+    // filler возвращает 1, когда буфер ядра заполнен - дальше продолжим с этого cookie
+    if (offset < 1 && filler(buf, ".", plus ? &st : NULL, 1, fill_flags)) return 0;
+    if (offset < 2 && filler(buf, "..", plus ? &st : NULL, 2, fill_flags)) return 0;
+
+    if (offset < 3) {
+        struct stat stats_st = st;
+        stats_st.st_mode = S_IFREG | 0444;
+        if (filler(buf, STATS_PATH + 1, plus ? &stats_st : NULL, 3, fill_flags)) return 0;
+    }
+
+    size_t start = offset > 3 ? (size_t) offset - 3 : 0;
+    for (size_t i = start; i < snap->listed.size(); i++) {
+        const UserRecord& user = snap->users[snap->listed[i]];
+        if (plus) {
+            st.st_uid = user.uid;
+            st.st_gid = user.gid;
+        }
+        if (filler(buf, user.name.c_str(), plus ? &st : NULL, (off_t) i + 4, fill_flags)) break;
+    }
+    return 0;
+}
+
 int users_readdir(
     const char* path,
     void* buf, 
@@ -121,39 +849,25 @@ int users_readdir(
     struct fuse_file_info* fi, 
     enum fuse_readdir_flags flags
 ) {
-    (void) offset;
-    (void) fi;
-    (void) flags;
-
-    // filler - функция, которая добавляет одну запись в виртуальную директорию
-    filler(buf, ".", NULL, 0, FUSE_FILL_DIR_PLUS);
-    filler(buf, "..", NULL, 0, FUSE_FILL_DIR_PLUS);
-
-    // Если в корне, то смотрим все user'ов в passwd, и пока находим новых проверяем их на шелл
-    // и заполняем buf в который ложим записи 
+    // Если в корне - пользователи с правильным шеллом из снимка passwd
     if (std::strcmp(path, "/") == 0) {
-        struct passwd* pwd;
-        setpwent();
-
-        while ((pwd = getpwent()) != NULL) {
-            if (valid_shell(pwd)) {
-                // buf - буфер куда ложим записи, pwd->pw_name - имя файла или директории
-                filler(buf, pwd->pw_name, NULL, 0, FUSE_FILL_DIR_PLUS);
-            }
-        }
-
-        endpwent();
-        return 0;
+        return readdir_root(buf, filler, offset, fi, flags);
     }
 
+    (void) offset;
+
     char username[256] = {0};
     if (sscanf(path, "/%255[^/]", username) == 1) {
-        struct passwd* pwd = getpwnam(username);
-        if (pwd != NULL) {
+        auto snap = current_snapshot();
+        if (snap->find(username) != NULL) {
+            // filler - функция, которая добавляет одну запись в виртуальную директорию
+            filler(buf, ".", NULL, 0, (enum fuse_fill_dir_flags) 0);
+            filler(buf, "..", NULL, 0, (enum fuse_fill_dir_flags) 0);
+
             // Складываем все файлы в каждом user в буфер
-            filler(buf, "id", NULL, 0, FUSE_FILL_DIR_PLUS);
-            filler(buf, "home", NULL, 0, FUSE_FILL_DIR_PLUS);
-            filler(buf, "shell", NULL, 0, FUSE_FILL_DIR_PLUS);
+            for (const char* name : USER_FILES) {
+                filler(buf, name, NULL, 0, (enum fuse_fill_dir_flags) 0);
+            }
             return 0;
         }
     }
@@ -162,37 +876,78 @@ int users_readdir(
     return -ENOENT;
 }
 
+// .stats снимается один раз при открытии: последовательные read видят один и тот же текст
+static int check_writable(const char* path, std::string& username, std::string& filename);
+
+int users_open(const char* path, struct fuse_file_info* fi) {
+    fi->fh = 0;
+    if (std::strcmp(path, STATS_PATH) == 0) {
+        if ((fi->flags & O_ACCMODE) != O_RDONLY) return -EACCES;
+        fi->fh = reinterpret_cast<uint64_t>(new std::string(vfs_stats_report()));
+        fi->direct_io = 1;
+        return 0;
+    }
+    if ((fi->flags & O_ACCMODE) == O_RDONLY) return 0;
+
+    auto* handle = new WriteHandle;
+    int err = check_writable(path, handle->username, handle->filename);
+    if (err != 0) {
+        delete handle;
+        return err;
+    }
+
+    // С FUSE_CAP_ATOMIC_O_TRUNC (по умолчанию в libfuse) O_TRUNC приходит только сюда,
+    // отдельного truncate не будет - иначе "echo /bin/sh > shell" оставит хвост /bin/bash
+    if (fi->flags & O_TRUNC) {
+        handle->seeded = true;
+        handle->dirty = true;
+    }
+    fi->fh = reinterpret_cast<uint64_t>(handle);
+    return 0;
+}
+
+int users_release(const char* path, struct fuse_file_info* fi) {
+    if (std::strcmp(path, STATS_PATH) == 0) {
+        delete reinterpret_cast<std::string*>(fi->fh);
+    } else {
+        delete reinterpret_cast<WriteHandle*>(fi->fh);
+    }
+    fi->fh = 0;
+    return 0;
+}
+
+static WriteHandle* write_handle(struct fuse_file_info* fi) {
+    return fi ? reinterpret_cast<WriteHandle*>(fi->fh) : nullptr;
+}
+
 int users_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
-    (void) fi;
+    if (std::strcmp(path, STATS_PATH) == 0) {
+        const std::string* report = fi ? reinterpret_cast<const std::string*>(fi->fh) : nullptr;
+        if (!report || (size_t) offset >= report->size()) return 0;
+
+        size = std::min(size, report->size() - offset);
+        std::memcpy(buf, report->data() + offset, size);
+        return size;
+    }
 
     char username[256];
     char filename[256];
 
-    // Разбиваем path на 2 части: имя и файл (id/dir/shell)
-    std::sscanf(path, "/%255[^/]/%255[^/]", username, filename);
+    // Разбиваем path на 2 части: имя и файл (id/home/shell/...)
+    if (std::sscanf(path, "/%255[^/]/%255[^/]", username, filename) != 2)
+        return -ENOENT;
 
-    // Ищем в pwd информацию о username
-    struct passwd* pwd = getpwnam(username);
-    if(!pwd) return -ENOENT;
-    
-    char content[256];
-    content[0] = '\0';
+    // Ищем в снимке информацию о username
+    auto snap = current_snapshot();
+    const UserRecord* user = snap->find(username);
+    if (!user) return -ENOENT;
 
-    if (std::strcmp(filename, "id") == 0) {
-        // content - куда записываем, 256 байт максимум, %d - целое число, берем из pw_uid
-        std::snprintf(content, sizeof(content), "%d", pwd->pw_uid);
-    }
-    else if (std::strcmp(filename, "home") == 0) {
-        // %s - строка
-        std::snprintf(content, sizeof(content), "%s", pwd->pw_dir);
-    }
-    else {
-        std::snprintf(content, sizeof(content), "%s", pwd->pw_shell);
-    }
+    std::string content;
+    int err = user_file_content(*snap, *user, filename, content);
+    if (err != 0) return err;
 
-    size_t len = std::strlen(content);
+    size_t len = content.size();
     if (len > 0 && content[len-1] == '\n') {
-        content[len-1] = '\0';
         len--;
     }
 
@@ -207,24 +962,130 @@ int users_read(const char* path, char* buf, size_t size, off_t offset, struct fu
     }
 
     // Копируем данные в буфер 
-    std::memcpy(buf, content + offset, size);
+    std::memcpy(buf, content.data() + offset, size);
     
     // Возврат сколько байт прочитали
     return size;
 }
 
+// Открыть shell/home на запись или обрезать по пути: только root и только существующий пользователь
+static int check_writable(const char* path, std::string& username, std::string& filename) {
+    char user_buf[256];
+    char file_buf[256];
+
+    if (std::sscanf(path, "/%255[^/]/%255[^/]", user_buf, file_buf) != 2)
+        return -ENOENT;
+    if (!is_writable_file(file_buf))
+        return -EACCES;
+
+    // Менять passwd может только root
+    if (fuse_get_context()->uid != 0)
+        return -EACCES;
+
+    if (!current_snapshot()->find(user_buf)) return -ENOENT;
+
+    username = user_buf;
+    filename = file_buf;
+    return 0;
+}
+
+// Черновик заводится первой записью и начинается с текущего значения
+static void seed_draft(WriteHandle& handle) {
+    if (handle.seeded) return;
+    handle.seeded = true;
+
+    auto snap = current_snapshot();
+    const UserRecord* user = snap->find(handle.username.c_str());
+    if (user) user_file_content(*snap, *user, handle.filename.c_str(), handle.draft);
+}
+
+int users_truncate(const char* path, off_t size, struct fuse_file_info* fi) {
+    // resize на гигабайты бросил бы bad_alloc прямо в потоке FUSE
+    if (size < 0 || (size_t) size > MAX_DRAFT_SIZE) return -EFBIG;
+
+    WriteHandle* handle = write_handle(fi);
+    if (handle) {
+        seed_draft(*handle);
+        handle->draft.resize(size);
+        handle->dirty = true;
+        return 0;
+    }
+
+    // truncate по пути: дескриптора и flush не будет - проверяем и ставим в очередь сразу
+    WriteHandle once;
+    int err = check_writable(path, once.username, once.filename);
+    if (err != 0) return err;
+    seed_draft(once);
+    once.draft.resize(size);
+    return commit_draft(once.username, once.filename.c_str(), std::move(once.draft));
+}
+
+int users_write(const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    if (offset < 0 || size > MAX_DRAFT_SIZE || (size_t) offset > MAX_DRAFT_SIZE - size) return -EFBIG;
+
+    (void) path;
+    WriteHandle* handle = write_handle(fi);
+    if (!handle) return -EBADF;
+
+    // Пишем в черновик дескриптора, в passwd уйдет при закрытии/сбросе
+    seed_draft(*handle);
+    handle->dirty = true;
+    std::string& draft = handle->draft;
+    if (draft.size() < offset + size) {
+        draft.resize(offset + size);
+    }
+    std::memcpy(&draft[offset], buf, size);
+    return size;
+}
+
+// Закрытие файла: проверяем значение и ставим в очередь на сброс.
+// Коммитит только дескриптор, который сам писал; черновик остается в нем до release.
+int users_flush(const char* path, struct fuse_file_info* fi) {
+    if (std::strcmp(path, STATS_PATH) == 0) return 0;
+
+    WriteHandle* handle = write_handle(fi);
+    if (!handle || !handle->dirty) return 0;
+    handle->dirty = false;
+    return commit_draft(handle->username, handle->filename.c_str(), handle->draft);
+}
+
+// fsync - сбросить все накопленное в passwd прямо сейчас
+int users_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+    (void) datasync;
+
+    int err = users_flush(path, fi);
+    if (err != 0) return err;
+    return writeback_pending();
+}
+
+// Запросы всегда читаем в память. С FUSE_CAP_SPLICE_READ (libfuse включает его сам)
+// большой write остается в пайпе прочитавшего потока: заголовок не разобрать,
+// и отдать такой буфер в пул нельзя - пайп у каждого потока свой.
+void* users_init(struct fuse_conn_info* conn, struct fuse_config* cfg) {
+    (void) cfg;
+    conn->want &= ~FUSE_CAP_SPLICE_READ;
+    return fuse_get_context()->private_data;
+}
+
+void users_destroy(void* private_data) {
+    (void) private_data;
+    writeback_pending();
+}
+
 int users_mkdir(const char* path, mode_t mode) {
     (void) mode;
 
     char username[256];
 
+    if (std::strcmp(path, STATS_PATH) == 0) return -EEXIST;
+
     // Если извлекли только имя пользователя из path
     if (std::sscanf(path, "/%255[^/]", username) == 1) {
-        // Открываем pwd и ищем username
-        struct passwd* pwd = getpwnam(username);
+        // Ищем username в снимке passwd
+        auto snap = current_snapshot();
         
         // Возврат если такой пользователь уже существует 
-        if (pwd != NULL) {
+        if (snap->find(username) != NULL) {
             return -EEXIST;
         }
 
@@ -247,14 +1108,16 @@ int users_mkdir(const char* path, mode_t mode) {
 
 int users_rmdir(const char* path) {
     char username[256];
+
+    if (std::strcmp(path, STATS_PATH) == 0) return -ENOTDIR;
     
     // Если извлекли только имя пользователя из path
     if (std::sscanf(path, "/%255[^/]", username) == 1) {
         // Проверка есть ли вложенные файлы в path
         // Если не находим "/" в path не считая первый (/.../ <-- типо такого)
         if (std::strchr(path + 1, '/') == NULL) {
-            struct passwd* pwd = getpwnam(username);
-            if (pwd != NULL) {
+            auto snap = current_snapshot();
+            if (snap->find(username) != NULL) {
                 char* const argv[] = {
                     (char*)"userdel", 
                     (char*)"--remove", 
@@ -279,32 +1142,49 @@ int users_rmdir(const char* path) {
 // ============================================================================
 
 // Структура в которой описаны функции которые переопределим для vfs
-// Инициализирую все нулями, потом с помощью функции переопределю нужные 5
+// Инициализирую все нулями, потом с помощью функции переопределю нужные
 struct fuse_operations users_operations = {};
 
+// Основные операции идут через Timed - их видно в .stats и в vfsstat
 void init_users_operations() {
-    users_operations.getattr = users_getattr;
-    users_operations.readdir = users_readdir;
-    users_operations.mkdir   = users_mkdir;
-    users_operations.rmdir   = users_rmdir;
-    users_operations.read    = users_read;
+    users_operations.getattr = Timed<OP_GETATTR, users_getattr>::call;
+    users_operations.opendir = users_opendir;
+    users_operations.readdir = Timed<OP_READDIR, users_readdir>::call;
+    users_operations.releasedir = users_releasedir;
+    users_operations.mkdir   = Timed<OP_MKDIR, users_mkdir>::call;
+    users_operations.rmdir   = Timed<OP_RMDIR, users_rmdir>::call;
+    users_operations.open    = users_open;
+    users_operations.release = users_release;
+    users_operations.read    = Timed<OP_READ, users_read>::call;
+    users_operations.write   = users_write;
+    users_operations.truncate = users_truncate;
+    users_operations.flush   = users_flush;
+    users_operations.fsync   = users_fsync;
+    users_operations.init    = users_init;
+    users_operations.destroy = users_destroy;
 }
 
 // ============================================================================
 // ПОТОК ДЛЯ FUSE
 // ============================================================================
 
+// Точка монтирования, живет все время работы FUSE потока
+static std::string mount_point;
+
+// Отключение лишних логов libfuse. Раньше для этого подменялся STDERR_FILENO
+// всего процесса, и вместе с логами FUSE пропадали ошибки самого шелла.
+static void quiet_fuse_log(enum fuse_log_level level, const char* fmt, va_list ap) {
+    (void) level;
+    (void) fmt;
+    (void) ap;
+}
+
 void* fuse_thread_function(void* arg) {
     (void) arg;
 
     // Вызов функции для инициализации
     init_users_operations();
-
-    // Отключение лишних логов
-    int devnull = open("/dev/null", O_WRONLY);
-    int olderr = dup(STDERR_FILENO);
-    dup2(devnull, STDERR_FILENO);
-    close(devnull);
+    fuse_set_log_func(quiet_fuse_log);
 
     // Аргументы для fuse_main
     char* fuse_argv[] = {
@@ -312,7 +1192,7 @@ void* fuse_thread_function(void* arg) {
         (char*) "-f",
         (char*) "-odefault_permissions",    // Стандартные права доступа
         (char*) "-oauto_unmount",           // Автоматическое размонтирование
-        (char*) "/opt/users"                // Куда монтируем
+        (char*) mount_point.c_str()         // Куда монтируем
     };
 
     // Количество аргументов
@@ -323,18 +1203,229 @@ void* fuse_thread_function(void* arg) {
     // Последний аргумент нам не нужен
     fuse_main(fuse_argc, (char**)fuse_argv, &users_operations, nullptr);
 
-    // Возврат логов
-    dup2(olderr, STDERR_FILENO);
-    close(olderr);
-
     return nullptr;
 }
 
+// ============================================================================
+// РЕЖИМ СОБЫТИЙНОГО ЦИКЛА
+// ============================================================================
+
+// Сессия FUSE без своего потока: fd сессии слушает общий epoll шелла,
+// запросы обрабатываются прямо в цикле. Медленные (mkdir/rmdir запускают
+// adduser/userdel, fsync переписывает passwd) уходят в небольшой пул.
+
+// Коды операций из заголовка запроса (linux/fuse.h)
+static const uint32_t FUSE_OPCODE_MKDIR = 9;
+static const uint32_t FUSE_OPCODE_RMDIR = 11;
+static const uint32_t FUSE_OPCODE_FSYNC = 20;
+
+static const size_t POOL_THREADS = 4;
+static const size_t POOL_QUEUE_LIMIT = 64;
+
+static struct fuse* session_fuse = nullptr;
+static struct fuse_session* session = nullptr;
+static int session_fd = -1;
+
+static std::mutex pool_mutex;
+static std::condition_variable& pool_cv = *new std::condition_variable;
+static std::deque<struct fuse_buf> pool_queue;
+static std::vector<std::thread> pool_threads;
+static bool pool_stopping = false;
+
+// Пока основной поток выполняет встроенную команду (которая сама может
+// лезть в точку монтирования), запросы читает поток подкачки
+static std::atomic<bool> pump_wanted{false};
+// Включения вкладываются (сценарий -> run_command): подкачка нужна, пока счетчик > 0.
+// Меняет только основной поток.
+static int pump_depth = 0;
+static std::atomic<bool> pump_stopping{false};
+static std::atomic<int> pump_wake_fd{-1};
+static std::thread pump_thread;
+
+// Читает один запрос. fd неблокирующий: если его уже забрал другой поток - false.
+// Размонтирование снаружи (ENODEV) libfuse отмечает через fuse_session_exited.
+static bool receive_request(struct fuse_buf& buf) {
+    memset(&buf, 0, sizeof(buf));
+    int res = fuse_session_receive_buf(session, &buf);
+    if (res == -ENODEV) fuse_session_exit(session);
+    if (res <= 0) {
+        free(buf.mem);
+        return false;
+    }
+    return true;
+}
+
+static void process_request(struct fuse_buf& buf) {
+    fuse_session_process_buf(session, &buf);
+    free(buf.mem);
+}
+
+static bool is_slow_request(const struct fuse_buf& buf) {
+    // Буфер в пайпе (splice) - только на месте, в этом же потоке
+    if ((buf.flags & FUSE_BUF_IS_FD) || !buf.mem || buf.size < 2 * sizeof(uint32_t)) return false;
+
+    // struct fuse_in_header { uint32_t len; uint32_t opcode; ... }
+    uint32_t opcode;
+    std::memcpy(&opcode, static_cast<const char*>(buf.mem) + sizeof(uint32_t), sizeof(opcode));
+    return opcode == FUSE_OPCODE_MKDIR || opcode == FUSE_OPCODE_RMDIR || opcode == FUSE_OPCODE_FSYNC;
+}
+
+static void pool_worker() {
+    block_thread_signals();
+
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    while (true) {
+        pool_cv.wait(lock, [] { return pool_stopping || !pool_queue.empty(); });
+        if (pool_queue.empty()) return;
+
+        struct fuse_buf buf = pool_queue.front();
+        pool_queue.pop_front();
+
+        lock.unlock();
+        process_request(buf);
+        lock.lock();
+    }
+}
+
+// Очередь ограничена: если она полна, запрос обрабатывается на месте
+static bool submit_to_pool(struct fuse_buf& buf) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (pool_stopping || pool_queue.size() >= POOL_QUEUE_LIMIT) return false;
+
+    // Потоки заводим только когда пришел первый медленный запрос
+    if (pool_threads.empty()) {
+        for (size_t i = 0; i < POOL_THREADS; i++) {
+            pool_threads.emplace_back(pool_worker);
+        }
+    }
+
+    pool_queue.push_back(buf);
+    pool_cv.notify_one();
+    return true;
+}
+
+bool vfs_session_process() {
+    struct fuse_buf buf;
+    if (!receive_request(buf)) return !fuse_session_exited(session);
+
+    if (!is_slow_request(buf) || !submit_to_pool(buf)) {
+        process_request(buf);
+    }
+    return true;
+}
+
+static void pump_thread_function() {
+    block_thread_signals();
+
+    while (!pump_stopping) {
+        struct pollfd fds[2] = {
+            {pump_wake_fd, POLLIN, 0},
+            {session_fd, POLLIN, 0},
+        };
+        // Пока подкачка не нужна - спим только на eventfd
+        int nfds = pump_wanted ? 2 : 1;
+        if (poll(fds, nfds, -1) < 0) continue;
+
+        if (fds[0].revents & POLLIN) {
+            uint64_t value;
+            ssize_t n = read(pump_wake_fd, &value, sizeof(value));
+            (void) n;
+        }
+        // После размонтирования fd всегда "готов" - не крутимся на нем
+        if (nfds == 2 && fds[1].revents != 0 && !vfs_session_process()) {
+            break;
+        }
+    }
+}
+
+void vfs_session_pump(bool on) {
+    pump_depth += on ? 1 : -1;
+    on = pump_depth > 0;
+    if (pump_wanted == on) return;
+
+    // Флаг ставим и до монтирования: поток подкачки стартует уже с ним
+    pump_wanted = on;
+    if (pump_wake_fd < 0) return;
+    uint64_t one = 1;
+    ssize_t n = write(pump_wake_fd, &one, sizeof(one));
+    (void) n;
+}
+
+int vfs_session_start(const std::string& mountpoint) {
+    init_users_operations();
+    fuse_set_log_func(quiet_fuse_log);
+    mount_point = mountpoint;
+
+    // Без -oauto_unmount: размонтируем сами в vfs_session_stop
+    char* fuse_argv[] = {
+        (char*) "kubsh",
+        (char*) "-odefault_permissions",
+    };
+    struct fuse_args args = FUSE_ARGS_INIT(2, fuse_argv);
+
+    session_fuse = fuse_new(&args, &users_operations, sizeof(users_operations), nullptr);
+    if (!session_fuse) return -1;
+
+    if (fuse_mount(session_fuse, mount_point.c_str()) != 0) {
+        fuse_destroy(session_fuse);
+        session_fuse = nullptr;
+        return -1;
+    }
+
+    session = fuse_get_session(session_fuse);
+    session_fd = fuse_session_fd(session);
+    fcntl(session_fd, F_SETFL, fcntl(session_fd, F_GETFL) | O_NONBLOCK);
+
+    pump_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (pump_wake_fd >= 0) {
+        pump_thread = std::thread(pump_thread_function);
+    }
+    return session_fd;
+}
+
+void vfs_session_stop() {
+    if (!session_fuse) return;
+
+    if (pump_thread.joinable()) {
+        pump_stopping = true;
+        uint64_t one = 1;
+        ssize_t n = write(pump_wake_fd, &one, sizeof(one));
+        (void) n;
+        pump_thread.join();
+    }
+    if (pump_wake_fd >= 0) {
+        close(pump_wake_fd);
+        pump_wake_fd = -1;
+    }
+
+    // Дожидаемся запросов, уже отданных пулу
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        pool_stopping = true;
+    }
+    pool_cv.notify_all();
+    for (auto& t : pool_threads) {
+        t.join();
+    }
+    pool_threads.clear();
+
+    writeback_pending();
+
+    fuse_session_exit(session);
+    fuse_unmount(session_fuse);
+    fuse_destroy(session_fuse);
+    session_fuse = nullptr;
+    session = nullptr;
+    session_fd = -1;
+}
+
 // ============================================================================
 // ОСНОВНАЯ ФУНКЦИЯ ЗАПУСКА
 // ============================================================================
 
-void fuse_start() {
+void fuse_start(const std::string& mountpoint) {
+    mount_point = mountpoint;
+
     // Создаем поток fuse_thread
     pthread_t fuse_thread;
 
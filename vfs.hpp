@@ -1,5 +1,36 @@
 
 
-void fuse_start();
+#include <string>
 
+void fuse_start(const std::string& mountpoint);
 
+// Немедленно сбросить накопленные изменения shell/home в /etc/passwd
+void vfs_sync();
+
+// Задержка между первым изменением shell/home и перезаписью passwd
+void vfs_set_writeback_delay(int ms);
+
+// ==================== Режим событийного цикла ====================
+
+// Монтирует VFS без отдельного потока. Возвращает fd сессии для epoll или -1.
+int vfs_session_start(const std::string& mountpoint);
+
+// fd сессии готов к чтению: принять и обработать один запрос
+// (медленные mkdir/rmdir/fsync уходят в ограниченный пул).
+// false - сессия закончилась (VFS размонтировали), fd больше не слушать.
+bool vfs_session_process();
+
+// Пока основной поток занят командой, запросы обслуживает поток подкачки.
+// Вызовы парные и могут вкладываться: true ... false.
+void vfs_session_pump(bool on);
+
+// Дождаться пула, сбросить изменения passwd и размонтировать
+void vfs_session_stop();
+
+// ==================== Статистика ====================
+
+// Счетчики и задержки операций FUSE по всем потокам, то же, что в <mount>/.stats
+std::string vfs_stats_report();
+
+// Обнулить статистику (дальше считаем с нуля)
+void vfs_stats_reset();